@@ -26,9 +26,19 @@
 #include "accessible-cache.h"
 #include "accessible-register.h"
 #include "bridge.h"
+#include "spi-probes.h"
+#include "spi-trace.h"
 
 SpiCache *spi_global_cache = NULL;
 
+/*
+ * Cache population walks newly added subtrees from an idle handler. Each
+ * run is limited to a time slice so that a large subtree appearing doesn't
+ * stall the application, and runs below the priority of redraws.
+ */
+#define SPI_CACHE_ADD_TIME_SLICE_US 8000
+#define SPI_CACHE_ADD_PRIORITY      (G_PRIORITY_DEFAULT_IDLE + 10)
+
 static gboolean
 child_added_listener (GSignalInvocationHint * signal_hint,
                       guint n_param_values,
@@ -50,6 +60,12 @@ add_subtree (SpiCache *cache, AtkObject * accessible);
 static gboolean
 add_pending_items (gpointer data);
 
+static void
+queue_object (SpiCache * cache, AtkObject * accessible);
+
+static void
+schedule_pending_items (SpiCache * cache);
+
 /*---------------------------------------------------------------------------*/
 
 static void
@@ -107,6 +123,7 @@ spi_cache_init (SpiCache * cache)
 {
   cache->objects = g_hash_table_new (g_direct_hash, g_direct_equal);
   cache->add_traversal = g_queue_new ();
+  cache->add_queued = g_hash_table_new (g_direct_hash, g_direct_equal);
 
 #ifdef SPI_ATK_DEBUG
   if (g_thread_supported ())
@@ -137,8 +154,12 @@ spi_cache_finalize (GObject * object)
   while (!g_queue_is_empty (cache->add_traversal))
     g_object_unref (G_OBJECT (g_queue_pop_head (cache->add_traversal)));
   g_queue_free (cache->add_traversal);
+  g_hash_table_unref (cache->add_queued);
   g_hash_table_unref (cache->objects);
 
+  if (cache->add_pending_idle)
+    g_source_remove (cache->add_pending_idle);
+
   g_signal_handlers_disconnect_by_func (spi_global_register,
                                         (GCallback) remove_object, cache);
 
@@ -162,29 +183,47 @@ remove_object (GObject * source, GObject * gobj, gpointer data)
 #ifdef SPI_ATK_DEBUG
   g_debug ("CACHE REM - %s - %d - %s\n", atk_object_get_name (ATK_OBJECT (gobj)),
             atk_object_get_role (ATK_OBJECT (gobj)),
-            spi_register_object_to_path (spi_global_register, gobj));
+            spi_register_object_get_path (spi_global_register, gobj));
 #endif
+      SPI_PROBE1 (cache_remove, gobj);
       g_signal_emit (cache, cache_signals [OBJECT_REMOVED], 0, gobj);
       g_hash_table_remove (cache->objects, gobj);
     }
-  else if (g_queue_remove (cache->add_traversal, gobj))
+  else if (g_hash_table_remove (cache->add_queued, gobj))
     {
-      g_object_unref (gobj);
+      if (g_queue_remove (cache->add_traversal, gobj))
+        g_object_unref (gobj);
     }
 }
 
+static guint
+parent_to_ref (AtkObject * accessible)
+{
+  AtkObject *parent = atk_object_get_parent (accessible);
+
+  return parent ? spi_register_object_to_ref (G_OBJECT (parent)) : 0;
+}
+
 static void
 add_object (SpiCache * cache, GObject * gobj)
 {
   g_return_if_fail (G_IS_OBJECT (gobj));
 
-  g_hash_table_insert (cache->objects, gobj, NULL);
+  /*
+   * Remember the parent, which can't be asked for once gobj is finalized,
+   * by its reference as the parent may be finalized first
+   */
+  g_hash_table_insert (cache->objects, gobj,
+                       GUINT_TO_POINTER (ATK_IS_OBJECT (gobj) ?
+                                         parent_to_ref (ATK_OBJECT (gobj)) :
+                                         0));
 
 #ifdef SPI_ATK_DEBUG
   g_debug ("CACHE ADD - %s - %d - %s\n", atk_object_get_name (ATK_OBJECT (gobj)),
             atk_object_get_role (ATK_OBJECT (gobj)),
-            spi_register_object_to_path (spi_global_register, gobj));
+            spi_register_object_get_path (spi_global_register, gobj));
 #endif
+  SPI_PROBE1 (cache_add, gobj);
 
   g_signal_emit (cache, cache_signals [OBJECT_ADDED], 0, gobj);
 }
@@ -219,8 +258,35 @@ recursion_check_unset ()
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Queues an object to be added to the cache, taking over the
+ * caller's reference. Objects already waiting to be added are
+ * only queued once.
+ */
+static void
+queue_object (SpiCache * cache, AtkObject * accessible)
+{
+  if (g_hash_table_lookup_extended (cache->add_queued, accessible, NULL, NULL))
+    {
+      g_object_unref (accessible);
+      return;
+    }
+
+  g_hash_table_insert (cache->add_queued, accessible, NULL);
+  g_queue_push_tail (cache->add_traversal, accessible);
+}
+
 static void
-append_children (AtkObject * accessible, GQueue * traversal)
+schedule_pending_items (SpiCache * cache)
+{
+  if (cache->add_pending_idle == 0)
+    cache->add_pending_idle = g_idle_add_full (SPI_CACHE_ADD_PRIORITY,
+                                               add_pending_items, cache,
+                                               NULL);
+}
+
+static void
+append_children (SpiCache * cache, AtkObject * accessible)
 {
   AtkObject *current;
   guint i;
@@ -233,38 +299,24 @@ append_children (AtkObject * accessible, GQueue * traversal)
       current = atk_object_ref_accessible_child (accessible, i);
       if (current)
         {
-          g_queue_push_tail (traversal, current);
+          queue_object (cache, current);
         }
     }
 }
 
 /*
- * Adds a subtree of accessible objects
- * to the cache at the accessible object provided.
- *
- * The leaf nodes do not have their children
- * registered. A node is considered a leaf
- * if it has the state "manages-descendants"
- * or if it has already been registered.
+ * Walks queued objects for one time slice, adding them to the cache.
+ * Returns TRUE if there are objects left to add.
  */
-static void
-add_subtree (SpiCache *cache, AtkObject * accessible)
-{
-  g_return_if_fail (ATK_IS_OBJECT (accessible));
-
-  g_object_ref (accessible);
-  g_queue_push_tail (cache->add_traversal, accessible);
-  add_pending_items (cache);
-}
-
 static gboolean
-add_pending_items (gpointer data)
+process_pending_items (SpiCache * cache)
 {
-  SpiCache *cache = SPI_CACHE (data);
   AtkObject *current;
   GQueue *to_add;
+  gint64 deadline;
 
   to_add = g_queue_new ();
+  deadline = g_get_monotonic_time () + SPI_CACHE_ADD_TIME_SLICE_US;
 
   while (!g_queue_is_empty (cache->add_traversal))
     {
@@ -282,34 +334,76 @@ add_pending_items (gpointer data)
               !atk_state_set_contains_state  (set, ATK_STATE_MANAGES_DESCENDANTS) &&
               !atk_state_set_contains_state  (set, ATK_STATE_DEFUNCT))
             {
-              append_children (current, cache->add_traversal);
+              append_children (cache, current);
             }
         }
       else
         {
           /* drop the ref for the removed object */
+          g_hash_table_remove (cache->add_queued, current);
           g_object_unref (current);
         }
 
       if (set)
         g_object_unref (set);
+
+      if (g_get_monotonic_time () >= deadline)
+        break;
     }
 
+  /*
+   * Parents are always walked before their children, so adding what was
+   * walked in this slice still announces each object after its parent.
+   */
   while (!g_queue_is_empty (to_add))
     {
       current = g_queue_pop_head (to_add);
 
       /* Make sure object is registerd so we are notified if it goes away */
-      g_free (spi_register_object_to_path (spi_global_register,
-              G_OBJECT (current)));
+      spi_register_object_get_path (spi_global_register, G_OBJECT (current));
 
+      g_hash_table_remove (cache->add_queued, current);
       add_object (cache, G_OBJECT(current));
       g_object_unref (G_OBJECT (current));
     }
 
   g_queue_free (to_add);
-  cache->add_pending_idle = 0;
-  return FALSE;
+  return !g_queue_is_empty (cache->add_traversal);
+}
+
+/*
+ * Adds a subtree of accessible objects
+ * to the cache at the accessible object provided.
+ *
+ * The leaf nodes do not have their children
+ * registered. A node is considered a leaf
+ * if it has the state "manages-descendants"
+ * or if it has already been registered.
+ */
+static void
+add_subtree (SpiCache *cache, AtkObject * accessible)
+{
+  g_return_if_fail (ATK_IS_OBJECT (accessible));
+
+  g_object_ref (accessible);
+  queue_object (cache, accessible);
+  if (process_pending_items (cache))
+    schedule_pending_items (cache);
+}
+
+static gboolean
+add_pending_items (gpointer data)
+{
+  SpiCache *cache = SPI_CACHE (data);
+  gint64 trace_start = spi_trace_begin ();
+  gboolean more;
+
+  more = process_pending_items (cache);
+  if (!more)
+    cache->add_pending_idle = 0;
+
+  spi_trace_end ("add_pending_items", "cache", NULL, trace_start);
+  return more;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -355,10 +449,8 @@ child_added_listener (GSignalInvocationHint * signal_hint,
             }
 
           g_object_ref (child);
-          g_queue_push_tail (cache->add_traversal, child);
-
-          if (cache->add_pending_idle == 0)
-            cache->add_pending_idle = g_idle_add (add_pending_items, cache);
+          queue_object (cache, child);
+          schedule_pending_items (cache);
         }
 #ifdef SPI_ATK_DEBUG
       recursion_check_unset ();
@@ -397,10 +489,11 @@ toplevel_added_listener (AtkObject * accessible,
       else
         g_object_ref (child);
 
-      g_queue_push_tail (cache->add_traversal, child);
-
-      if (cache->add_pending_idle == 0)
-        cache->add_pending_idle = g_idle_add (add_pending_items, cache);
+      if (child)
+        {
+          queue_object (cache, child);
+          schedule_pending_items (cache);
+        }
 #ifdef SPI_ATK_DEBUG
       recursion_check_unset ();
 #endif
@@ -417,6 +510,33 @@ spi_cache_foreach (SpiCache * cache, GHFunc func, gpointer data)
   g_hash_table_foreach (cache->objects, func, data);
 }
 
+/*
+ * Returns the register reference of the object's parent, as it was when
+ * the object was added to the cache or last reparented, or 0 if it had no
+ * registered parent.
+ */
+guint
+spi_cache_get_parent_ref (SpiCache * cache, GObject * object)
+{
+  if (!cache)
+    return 0;
+
+  return GPOINTER_TO_UINT (g_hash_table_lookup (cache->objects, object));
+}
+
+/*
+ * Records the object's new parent after an accessible-parent change.
+ */
+void
+spi_cache_parent_changed (SpiCache * cache, GObject * object)
+{
+  if (!ATK_IS_OBJECT (object) || !spi_cache_in (cache, object))
+    return;
+
+  g_hash_table_insert (cache->objects, object,
+                       GUINT_TO_POINTER (parent_to_ref (ATK_OBJECT (object))));
+}
+
 gboolean
 spi_cache_in (SpiCache * cache, GObject * object)
 {
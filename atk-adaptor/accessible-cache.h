@@ -43,6 +43,7 @@ struct _SpiCache
 
   GHashTable * objects;
   GQueue *add_traversal;
+  GHashTable *add_queued;
   gint add_pending_idle;
 
   guint child_added_listener;
@@ -63,5 +64,11 @@ spi_cache_foreach (SpiCache * cache, GHFunc func, gpointer data);
 gboolean
 spi_cache_in (SpiCache * cache, GObject * object);
 
+guint
+spi_cache_get_parent_ref (SpiCache * cache, GObject * object);
+
+void
+spi_cache_parent_changed (SpiCache * cache, GObject * object);
+
 G_END_DECLS
 #endif /* ACCESSIBLE_CACHE_H */
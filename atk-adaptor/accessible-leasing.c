@@ -25,6 +25,8 @@
 #include <string.h>
 
 #include "accessible-leasing.h"
+#include "spi-probes.h"
+#include "spi-trace.h"
 
 #ifdef SPI_ATK_DEBUG
 #include "accessible-cache.h"
@@ -34,18 +36,47 @@
 
 SpiLeasing *spi_global_leasing;
 
-typedef struct _ExpiryElement
+/*
+  Each leased object has a single lease, which is renewed in place when
+  the object is leased again. Leases are kept in a hashed timer wheel of
+  one second buckets, indexed by expiry time. The wheel is advanced once
+  a second while there are leases; a lease that is more than a full turn
+  away stays in its bucket until the wheel comes round to it again.
+
+  The number of leases is capped. Leases are also kept in least recently
+  used order, and taking a new lease past the cap ends the oldest one
+  early. AT_SPI_LEASE_MAX overrides the default cap, 0 meaning no cap.
+*/
+#define WHEEL_SIZE 64
+#define DEFAULT_MAX_LEASES 4096
+
+/*
+  The lease time is expected to be in seconds, the rounding is going to be to
+  intervals of 1 second.
+
+  The lease time is going to be rounded up, as the lease time should be
+  considered a MINIMUM that the object will be leased for.
+
+  Leases start out between LEASE_MIN_S and LEASE_TIME_S long, depending
+  on how often clients recently came back for leased objects. An object
+  a client does come back for is leased for the full LEASE_TIME_S.
+*/
+#define LEASE_TIME_S 15
+#define LEASE_MIN_S 5
+
+typedef struct _SpiLease
 {
-  guint expiry_s;
+  gint64 expiry_s;
   GObject *object;
-} ExpiryElement;
+  gboolean used;
+  GList link;
+  GList lru_link;
+} SpiLease;
 
 static void spi_leasing_dispose (GObject * object);
 
 static void spi_leasing_finalize (GObject * object);
 
-static void add_expiry_timeout (SpiLeasing * leasing);
-
 /*---------------------------------------------------------------------------*/
 
 G_DEFINE_TYPE (SpiLeasing, spi_leasing, G_TYPE_OBJECT)
@@ -60,11 +91,52 @@ static void spi_leasing_class_init (SpiLeasingClass * klass)
   object_class->dispose = spi_leasing_dispose;
 }
 
+static void
+lease_free (SpiLease * lease)
+{
+#ifdef SPI_ATK_DEBUG
+  g_debug ("REVOKE - ");
+  spi_cache_print_info (lease->object);
+#endif
+
+  g_object_unref (lease->object);
+  g_slice_free (SpiLease, lease);
+}
+
 static void
 spi_leasing_init (SpiLeasing * leasing)
 {
-  leasing->expiry_queue = g_queue_new ();
+  const gchar *envvar;
+  gint i;
+
+  leasing->leases = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                           NULL, (GDestroyNotify) lease_free);
+  leasing->wheel = g_new (GQueue, WHEEL_SIZE);
+  for (i = 0; i < WHEEL_SIZE; i++)
+    g_queue_init (&leasing->wheel[i]);
+  g_queue_init (&leasing->lru);
+  leasing->wheel_time_s = 0;
   leasing->expiry_func_id = 0;
+
+  leasing->max_leases = DEFAULT_MAX_LEASES;
+  envvar = g_getenv ("AT_SPI_LEASE_MAX");
+  if (envvar)
+    {
+      gchar *end;
+      guint64 max;
+
+      /* g_ascii_strtoull would silently negate a leading minus sign */
+      max = g_ascii_strtoull (envvar, &end, 10);
+      if (end == envvar || *end || strchr (envvar, '-') || max > G_MAXUINT)
+        g_warning ("Ignoring invalid AT_SPI_LEASE_MAX value \"%s\"", envvar);
+      else
+        leasing->max_leases = max;
+    }
+
+  /* Until we know better, assume clients want everything */
+  leasing->hit_rate = 1.0;
+  memset (&leasing->stats, 0, sizeof (SpiLeasingStats));
+  leasing->stats.lease_time_s = LEASE_TIME_S;
 }
 
 static void
@@ -74,7 +146,8 @@ spi_leasing_finalize (GObject * object)
 
   if (leasing->expiry_func_id)
     g_source_remove (leasing->expiry_func_id);
-  g_queue_free (leasing->expiry_queue);
+  g_hash_table_destroy (leasing->leases);
+  g_free (leasing->wheel);
   G_OBJECT_CLASS (spi_leasing_parent_class)->finalize (object);
 }
 
@@ -82,100 +155,151 @@ static void
 spi_leasing_dispose (GObject * object)
 {
   SpiLeasing *leasing = SPI_LEASING (object);
+  gint i;
 
-  ExpiryElement *head;
-  while ((head = g_queue_pop_head (leasing->expiry_queue)))
-    {
-      g_object_unref (head->object);
-      g_slice_free (ExpiryElement, head);
-    }
+  /* The queue links are embedded in the leases, so just forget them */
+  for (i = 0; i < WHEEL_SIZE; i++)
+    g_queue_init (&leasing->wheel[i]);
+  g_queue_init (&leasing->lru);
+  g_hash_table_remove_all (leasing->leases);
   G_OBJECT_CLASS (spi_leasing_parent_class)->dispose (object);
 }
 
 /*---------------------------------------------------------------------------*/
 
+static gint64
+now_s (void)
+{
+  return g_get_monotonic_time () / G_USEC_PER_SEC;
+}
+
+static GQueue *
+wheel_bucket (SpiLeasing * leasing, gint64 expiry_s)
+{
+  return &leasing->wheel[expiry_s % WHEEL_SIZE];
+}
+
 /*
-  End the lease on all objects whose expiry time has passed.
- 
-  Check when the next event is and set the next expiry func.
+  Takes the lease out of the wheel and the LRU list, and feeds whether a
+  client used the object into the lease time for new leases. The caller
+  removes it from the lease table.
+*/
+static void
+lease_unlink (SpiLeasing * leasing, SpiLease * lease)
+{
+  guint range = LEASE_TIME_S - LEASE_MIN_S;
+
+  g_queue_unlink (wheel_bucket (leasing, lease->expiry_s), &lease->link);
+  g_queue_unlink (&leasing->lru, &lease->lru_link);
+
+  leasing->hit_rate = leasing->hit_rate * 0.875 + (lease->used ? 0.125 : 0);
+  leasing->stats.lease_time_s = LEASE_MIN_S
+                                + (guint) (range * leasing->hit_rate + 0.5);
+}
+
+/*
+  Advance the wheel to the current time, ending the lease on all objects
+  whose expiry time has passed in the buckets it moves over.
+
+  Keeps ticking while there are leases left.
 */
 static gboolean
 expiry_func (gpointer data)
 {
   SpiLeasing *leasing = SPI_LEASING (data);
+  GSList *expired = NULL, *l;
+  gint64 trace_start = spi_trace_begin ();
+  gint64 now;
+  gboolean more = TRUE;
 
-  ExpiryElement *head, *current;
-  GTimeVal t;
+  now = now_s ();
 
-  g_get_current_time (&t);
+  /* Visiting every bucket once is enough, however long we were away */
+  if (now - leasing->wheel_time_s > WHEEL_SIZE)
+    leasing->wheel_time_s = now - WHEEL_SIZE;
 
-  head = g_queue_peek_head (leasing->expiry_queue);
-  while (head != NULL && head->expiry_s <= t.tv_sec)
+  while (leasing->wheel_time_s < now)
     {
-      current = g_queue_pop_head (leasing->expiry_queue);
-
-#ifdef SPI_ATK_DEBUG
-      g_debug ("REVOKE - ");
-      spi_cache_print_info (current->object);
-#endif
+      GQueue *bucket;
+      GList *link, *next;
+
+      leasing->wheel_time_s++;
+      bucket = wheel_bucket (leasing, leasing->wheel_time_s);
+      for (link = bucket->head; link; link = next)
+        {
+          SpiLease *lease = link->data;
+
+          next = link->next;
+          if (lease->expiry_s <= now)
+            {
+              lease_unlink (leasing, lease);
+              g_hash_table_steal (leasing->leases, lease->object);
+              expired = g_slist_prepend (expired, lease);
+              leasing->stats.n_expired++;
+              SPI_PROBE1 (lease_expire, lease->object);
+            }
+        }
+    }
 
-      g_object_unref (current->object);
-      g_slice_free (ExpiryElement, current);
+  /*
+   * Dropping the last reference may run arbitrary code, which may take
+   * leases, so do it once the leases are out of every list
+   */
+  for (l = expired; l; l = l->next)
+    lease_free (l->data);
+  g_slist_free (expired);
 
-      head = g_queue_peek_head (leasing->expiry_queue);
+  if (g_hash_table_size (leasing->leases) == 0)
+    {
+      leasing->expiry_func_id = 0;
+      more = FALSE;
     }
 
-  leasing->expiry_func_id = 0;
-  add_expiry_timeout (leasing);
-
-  return FALSE;
+  spi_trace_end ("expiry_func", "leasing", NULL, trace_start);
+  return more;
 }
 
-/*---------------------------------------------------------------------------*/
-
 /*
-  Checks if an expiry timeout is already scheduled, if so returns.
-  This is becasue events will always be added to the end of the queue.
-  Events are always later in time to previoulsy added events.
-
-  Otherwise calculate the next wake time using the top of the queue
-  and add the next expiry function.
-
-  This function is called when a lease is added or at the end of the
-  expiry function to add the next expiry timeout.
+  Ends the least recently used leases until there are no more than
+  max_leases.
 */
 static void
-add_expiry_timeout (SpiLeasing * leasing)
+evict (SpiLeasing * leasing, guint max_leases)
 {
-  ExpiryElement *elem;
-  GTimeVal t;
-  guint next_expiry;
+  GSList *evicted = NULL, *l;
 
-  if (leasing->expiry_func_id != 0)
-    return;
+  while (g_hash_table_size (leasing->leases) > max_leases)
+    {
+      SpiLease *lease = g_queue_peek_head (&leasing->lru);
 
-  elem = (ExpiryElement *) g_queue_peek_head (leasing->expiry_queue);
-  if (elem == NULL)
-    return;
+      lease_unlink (leasing, lease);
+      g_hash_table_steal (leasing->leases, lease->object);
+      evicted = g_slist_prepend (evicted, lease);
+      leasing->stats.n_evicted++;
+      SPI_PROBE1 (lease_evict, lease->object);
+    }
 
-  /* The current time is implicitly rounded down here by ignoring the us */
-  g_get_current_time (&t);
-  next_expiry = elem->expiry_s - t.tv_sec;
-  leasing->expiry_func_id = g_timeout_add_seconds (next_expiry,
-                                                   expiry_func, leasing);
+  /* As in expiry_func, only drop the references once nothing links them */
+  for (l = evicted; l; l = l->next)
+    lease_free (l->data);
+  g_slist_free (evicted);
 }
 
 /*---------------------------------------------------------------------------*/
 
-/*
-  The lease time is expected to be in seconds, the rounding is going to be to
-  intervals of 1 second.
+static void
+lease_renew (SpiLeasing * leasing, SpiLease * lease, gint64 expiry_s)
+{
+  g_queue_unlink (&leasing->lru, &lease->lru_link);
+  g_queue_push_tail_link (&leasing->lru, &lease->lru_link);
 
-  The lease time is going to be rounded up, as the lease time should be
-  considered a MINIMUM that the object will be leased for.
-*/
-#define LEASE_TIME_S 15
-#define EXPIRY_TIME_S (LEASE_TIME_S + 1)
+  if (lease->expiry_s >= expiry_s)
+    return;
+
+  g_queue_unlink (wheel_bucket (leasing, lease->expiry_s), &lease->link);
+  lease->expiry_s = expiry_s;
+  g_queue_push_tail_link (wheel_bucket (leasing, expiry_s), &lease->link);
+}
 
 GObject *
 spi_leasing_take (SpiLeasing * leasing, GObject * object)
@@ -183,25 +307,50 @@ spi_leasing_take (SpiLeasing * leasing, GObject * object)
   /*
      Get the current time.
      Quantize the time.
-     Add the release event to the queue.
-     Check the next expiry.
+     Renew the object's lease, or give it one.
+     Make sure the wheel is turning.
    */
 
-  GTimeVal t;
-  guint expiry_s;
+  SpiLease *lease;
+  gint64 now, expiry_s;
+
+  now = now_s ();
+
+  lease = g_hash_table_lookup (leasing->leases, object);
+  if (lease)
+    {
+      expiry_s = now + (lease->used ? LEASE_TIME_S
+                                    : leasing->stats.lease_time_s) + 1;
+      lease_renew (leasing, lease, expiry_s);
+      leasing->stats.n_renewed++;
+      SPI_PROBE3 (lease_take, object, expiry_s, TRUE);
+      return object;
+    }
 
-  ExpiryElement *elem;
+  if (leasing->max_leases)
+    evict (leasing, leasing->max_leases - 1);
 
-  g_get_current_time (&t);
-  expiry_s = t.tv_sec + EXPIRY_TIME_S;
+  expiry_s = now + leasing->stats.lease_time_s + 1;
 
-  elem = g_slice_new (ExpiryElement);
-  elem->expiry_s = expiry_s;
-  elem->object = g_object_ref (object);
+  lease = g_slice_new (SpiLease);
+  lease->object = g_object_ref (object);
+  lease->used = FALSE;
+  lease->expiry_s = expiry_s;
+  lease->link.data = lease;
+  lease->lru_link.data = lease;
+  g_hash_table_insert (leasing->leases, object, lease);
+  g_queue_push_tail_link (wheel_bucket (leasing, expiry_s), &lease->link);
+  g_queue_push_tail_link (&leasing->lru, &lease->lru_link);
+  leasing->stats.n_taken++;
 
-  g_queue_push_tail (leasing->expiry_queue, elem);
+  if (!leasing->expiry_func_id)
+    {
+      leasing->wheel_time_s = now;
+      leasing->expiry_func_id = g_timeout_add_seconds (1, expiry_func,
+                                                       leasing);
+    }
 
-  add_expiry_timeout (leasing);
+  SPI_PROBE3 (lease_take, object, expiry_s, FALSE);
 
 #ifdef SPI_ATK_DEBUG
   g_debug ("LEASE - ");
@@ -211,4 +360,41 @@ spi_leasing_take (SpiLeasing * leasing, GObject * object)
   return object;
 }
 
+/*
+  Called when a client makes a call on an object. If the object is leased
+  its lease is extended to the full lease time.
+*/
+void
+spi_leasing_touch (SpiLeasing * leasing, GObject * object)
+{
+  SpiLease *lease;
+
+  lease = g_hash_table_lookup (leasing->leases, object);
+  if (!lease)
+    return;
+
+  if (!lease->used)
+    {
+      lease->used = TRUE;
+      leasing->stats.n_client_hits++;
+    }
+  lease_renew (leasing, lease, now_s () + LEASE_TIME_S + 1);
+}
+
+void
+spi_leasing_set_max_leases (SpiLeasing * leasing, guint max_leases)
+{
+  leasing->max_leases = max_leases;
+  if (max_leases)
+    evict (leasing, max_leases);
+}
+
+void
+spi_leasing_get_stats (SpiLeasing * leasing, SpiLeasingStats * stats)
+{
+  *stats = leasing->stats;
+  stats->n_leases = g_hash_table_size (leasing->leases);
+  stats->max_leases = leasing->max_leases;
+}
+
 /*END------------------------------------------------------------------------*/
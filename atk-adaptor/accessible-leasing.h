@@ -38,12 +38,33 @@ G_BEGIN_DECLS
 #define SPI_IS_LEASING(o)       (G_TYPE_CHECK__INSTANCE_TYPE ((o), SPI_LEASING_TYPE))
 #define SPI_IS_LEASING_CLASS(k) (G_TYPE_CHECK_CLASS_TYPE ((k), SPI_LEASING_TYPE))
 
+typedef struct _SpiLeasingStats SpiLeasingStats;
+
+struct _SpiLeasingStats
+{
+  guint n_leases;
+  guint max_leases;
+  guint lease_time_s;
+  guint64 n_taken;
+  guint64 n_renewed;
+  guint64 n_client_hits;
+  guint64 n_expired;
+  guint64 n_evicted;
+};
+
 struct _SpiLeasing
 {
   GObject parent;
 
-  GQueue *expiry_queue;
+  GHashTable *leases;
+  GQueue *wheel;
+  GQueue lru;
+  gint64 wheel_time_s;
   guint expiry_func_id;
+
+  guint max_leases;
+  gdouble hit_rate;
+  SpiLeasingStats stats;
 };
 
 struct _SpiLeasingClass
@@ -57,5 +78,11 @@ extern SpiLeasing *spi_global_leasing;
 
 GObject *spi_leasing_take (SpiLeasing * leasing, GObject * object);
 
+void spi_leasing_touch (SpiLeasing * leasing, GObject * object);
+
+void spi_leasing_set_max_leases (SpiLeasing * leasing, guint max_leases);
+
+void spi_leasing_get_stats (SpiLeasing * leasing, SpiLeasingStats * stats);
+
 G_END_DECLS
 #endif /* ACCESSIBLE_LEASING_H */
@@ -37,8 +37,16 @@
  * path for it. The D-Bus object paths used have a standard prefix
  * (SPI_ATK_OBJECT_PATH_PREFIX). Appended to this prefix is a string
  * representation of an integer reference. So to access an AtkObject 
- * remotely we keep a Hashtable that maps the given reference to 
- * the AtkObject pointer. An object in this hash table is said to be 'registered'.
+ * remotely we keep a table of slots that maps the given reference to 
+ * the AtkObject pointer. An object in this table is said to be 'registered'.
+ *
+ * A reference combines the index of the object's slot with the
+ * generation of that slot. Slots are reused once their object is
+ * deregistered, but their generation is bumped, so a stale reference held
+ * by a client doesn't resolve to the new occupant. Freed slots are
+ * reused in FIFO order and only once enough are free, which spreads reuse
+ * over many slots. A slot whose generation has run out is retired rather
+ * than letting it wrap around, so a reference is never handed out twice.
  *
  * The architecture of AT-SPI dbus is such that AtkObjects are not
  * remotely reference counted. This means that we need to keep track of
@@ -51,14 +59,33 @@
 #define SPI_ATK_OBJECT_PATH_PREFIX  "/org/a11y/atspi/accessible/"
 #define SPI_ATK_OBJECT_PATH_ROOT "root"
 
-#define SPI_ATK_OBJECT_REFERENCE_TEMPLATE SPI_ATK_OBJECT_PATH_PREFIX "%d"
+#define SPI_ATK_OBJECT_REFERENCE_TEMPLATE SPI_ATK_OBJECT_PATH_PREFIX "%u"
 
 #define SPI_DBUS_ID "spi-dbus-id"
+#define SPI_DBUS_PATH "spi-dbus-path"
+
+#define SPI_REGISTER_INDEX_BITS      20
+#define SPI_REGISTER_INDEX_MASK      ((1u << SPI_REGISTER_INDEX_BITS) - 1)
+#define SPI_REGISTER_GENERATION_MASK (G_MAXUINT >> SPI_REGISTER_INDEX_BITS)
+#define SPI_REGISTER_MIN_FREE        16384
+#define SPI_REGISTER_NO_SLOT         G_MAXUINT
+
+typedef struct _SpiRegisterSlot SpiRegisterSlot;
+struct _SpiRegisterSlot
+{
+  GObject *gobj;
+  gchar *path;
+  guint generation;
+  guint next_free;
+};
 
 SpiRegister *spi_global_register = NULL;
 
 static const gchar * spi_register_root_path = SPI_ATK_OBJECT_PATH_PREFIX SPI_ATK_OBJECT_PATH_ROOT;
 
+static GQuark quark_dbus_id = 0;
+static GQuark quark_dbus_path = 0;
+
 enum
 {
   OBJECT_REGISTERED,
@@ -84,6 +111,9 @@ static void spi_register_class_init (SpiRegisterClass * klass)
 
   object_class->finalize = spi_register_finalize;
 
+  quark_dbus_id = g_quark_from_static_string (SPI_DBUS_ID);
+  quark_dbus_path = g_quark_from_static_string (SPI_DBUS_PATH);
+
   register_signals [OBJECT_REGISTERED] =
       g_signal_new ("object-registered",
                     SPI_REGISTER_TYPE,
@@ -112,8 +142,11 @@ static void spi_register_class_init (SpiRegisterClass * klass)
 static void
 spi_register_init (SpiRegister * reg)
 {
-  reg->ref2ptr = g_hash_table_new (g_direct_hash, g_direct_equal);
-  reg->reference_counter = 0;
+  reg->slots = g_array_new (FALSE, TRUE, sizeof (SpiRegisterSlot));
+  reg->free_head = SPI_REGISTER_NO_SLOT;
+  reg->free_tail = SPI_REGISTER_NO_SLOT;
+  reg->n_free = 0;
+  reg->n_retired = 0;
 }
 
 static void
@@ -124,41 +157,126 @@ deregister_object (gpointer data, GObject * gobj)
   spi_register_deregister_object (reg, gobj, FALSE);
 }
 
-static void
-spi_register_remove_weak_ref (gpointer key, gpointer val, gpointer reg)
-{
-  g_object_weak_unref (val, deregister_object, reg);
-}
-
 static void
 spi_register_finalize (GObject * object)
 {
   SpiRegister *reg = SPI_REGISTER (object);
+  guint i;
 
-  g_hash_table_foreach (reg->ref2ptr, spi_register_remove_weak_ref, reg);
-  g_hash_table_unref (reg->ref2ptr);
+  for (i = 0; i < reg->slots->len; i++)
+    {
+      SpiRegisterSlot *slot = &g_array_index (reg->slots, SpiRegisterSlot, i);
+
+      if (slot->gobj)
+        g_object_weak_unref (slot->gobj, deregister_object, reg);
+      g_free (slot->path);
+    }
+  g_array_free (reg->slots, TRUE);
 
   G_OBJECT_CLASS (spi_register_parent_class)->finalize (object);
 }
 
 /*---------------------------------------------------------------------------*/
 
+static inline guint
+ref_index (guint ref)
+{
+  return ref & SPI_REGISTER_INDEX_MASK;
+}
+
+static inline guint
+ref_generation (guint ref)
+{
+  return ref >> SPI_REGISTER_INDEX_BITS;
+}
+
+/*
+ * Returns the slot a reference points at, or NULL if the reference
+ * is stale or was never assigned.
+ */
+static SpiRegisterSlot *
+ref_to_slot (SpiRegister * reg, guint ref)
+{
+  SpiRegisterSlot *slot;
+  guint index = ref_index (ref);
+
+  if (index >= reg->slots->len)
+    return NULL;
+
+  slot = &g_array_index (reg->slots, SpiRegisterSlot, index);
+  if (!slot->gobj || slot->generation != ref_generation (ref))
+    return NULL;
+  return slot;
+}
+
 /*
  * Each AtkObject must be asssigned a D-Bus path (Reference)
  *
- * This function provides an integer reference for a new
- * AtkObject.
- *
- * TODO: Make this reference a little more unique, this is shoddy.
+ * This function picks a slot for a new AtkObject and returns the
+ * reference for it, or 0 if the table is full.
  */
 static guint
 assign_reference (SpiRegister * reg)
 {
-  reg->reference_counter++;
-  /* Reference of 0 not allowed as used as direct key in hash table */
-  if (reg->reference_counter == 0)
-    reg->reference_counter++;
-  return reg->reference_counter;
+  SpiRegisterSlot *slot;
+  guint index;
+
+  if (reg->n_free > SPI_REGISTER_MIN_FREE ||
+      (reg->n_free && reg->slots->len > SPI_REGISTER_INDEX_MASK))
+    {
+      index = reg->free_head;
+      slot = &g_array_index (reg->slots, SpiRegisterSlot, index);
+      reg->free_head = slot->next_free;
+      if (reg->free_head == SPI_REGISTER_NO_SLOT)
+        reg->free_tail = SPI_REGISTER_NO_SLOT;
+      reg->n_free--;
+
+      slot->generation++;
+    }
+  else if (reg->slots->len <= SPI_REGISTER_INDEX_MASK)
+    {
+      index = reg->slots->len;
+      g_array_set_size (reg->slots, index + 1);
+      slot = &g_array_index (reg->slots, SpiRegisterSlot, index);
+    }
+  else
+    {
+      g_warning ("AT-SPI: too many accessible objects registered");
+      return 0;
+    }
+
+  /* Reference of 0 not allowed as it means 'not registered' */
+  if (slot->generation == 0)
+    slot->generation = 1;
+  slot->next_free = SPI_REGISTER_NO_SLOT;
+
+  return (slot->generation << SPI_REGISTER_INDEX_BITS) | index;
+}
+
+static void
+release_slot (SpiRegister * reg, guint ref)
+{
+  SpiRegisterSlot *slot;
+  guint index = ref_index (ref);
+
+  slot = &g_array_index (reg->slots, SpiRegisterSlot, index);
+  slot->gobj = NULL;
+  g_free (slot->path);
+  slot->path = NULL;
+
+  /* Another generation would wrap around to one handed out before */
+  if (slot->generation == SPI_REGISTER_GENERATION_MASK)
+    {
+      reg->n_retired++;
+      return;
+    }
+
+  if (reg->free_tail == SPI_REGISTER_NO_SLOT)
+    reg->free_head = index;
+  else
+    g_array_index (reg->slots, SpiRegisterSlot, reg->free_tail).next_free = index;
+  reg->free_tail = index;
+  reg->n_free++;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -169,16 +287,7 @@ assign_reference (SpiRegister * reg)
 static guint
 object_to_ref (GObject * gobj)
 {
-  return GPOINTER_TO_INT (g_object_get_data (gobj, SPI_DBUS_ID));
-}
-
-/*
- * Converts the Accessible object reference to its D-Bus object path
- */
-static gchar *
-ref_to_path (guint ref)
-{
-  return g_strdup_printf (SPI_ATK_OBJECT_REFERENCE_TEMPLATE, ref);
+  return GPOINTER_TO_UINT (g_object_get_qdata (gobj, quark_dbus_id));
 }
 
 /*---------------------------------------------------------------------------*/
@@ -192,21 +301,33 @@ ref_to_path (guint ref)
 void
 spi_register_deregister_object (SpiRegister *reg, GObject *gobj, gboolean unref)
 {
+  SpiRegisterSlot *slot;
   guint ref;
 
   ref = object_to_ref (gobj);
-  if (ref != 0)
+  slot = ref ? ref_to_slot (reg, ref) : NULL;
+  if (slot && slot->gobj == gobj)
     {
       g_signal_emit (reg,
                      register_signals [OBJECT_DEREGISTERED],
                      0,
                      gobj);
       if (unref)
-        g_object_weak_unref (gobj, deregister_object, reg);
-      g_hash_table_remove (reg->ref2ptr, GINT_TO_POINTER (ref));
+        {
+          /*
+           * The object lives on (eg. it is defunct). It keeps its path,
+           * which no longer resolves, but loses its reference, so that
+           * it can't be mistaken for whatever takes the slot next.
+           */
+          g_object_weak_unref (gobj, deregister_object, reg);
+          g_object_set_qdata_full (gobj, quark_dbus_path, slot->path, g_free);
+          slot->path = NULL;
+          g_object_set_qdata (gobj, quark_dbus_id, NULL);
+        }
+      release_slot (reg, ref);
 
 #ifdef SPI_ATK_DEBUG
-      g_debug ("DEREG  - %d", ref);
+      g_debug ("DEREG  - %u", ref);
 #endif
     }
 }
@@ -214,17 +335,22 @@ spi_register_deregister_object (SpiRegister *reg, GObject *gobj, gboolean unref)
 static void
 register_object (SpiRegister * reg, GObject * gobj)
 {
+  SpiRegisterSlot *slot;
   guint ref;
   g_return_if_fail (G_IS_OBJECT (gobj));
 
   ref = assign_reference (reg);
+  if (!ref)
+    return;
 
-  g_hash_table_insert (reg->ref2ptr, GINT_TO_POINTER (ref), gobj);
-  g_object_set_data (G_OBJECT (gobj), SPI_DBUS_ID, GINT_TO_POINTER (ref));
+  slot = &g_array_index (reg->slots, SpiRegisterSlot, ref_index (ref));
+  slot->gobj = gobj;
+  slot->path = g_strdup_printf (SPI_ATK_OBJECT_REFERENCE_TEMPLATE, ref);
+  g_object_set_qdata (G_OBJECT (gobj), quark_dbus_id, GUINT_TO_POINTER (ref));
   g_object_weak_ref (G_OBJECT (gobj), deregister_object, reg);
 
 #ifdef SPI_ATK_DEBUG
-  g_debug ("REG  - %d", ref);
+  g_debug ("REG  - %u", ref);
 #endif
 
   g_signal_emit (reg, register_signals [OBJECT_REGISTERED], 0, gobj);
@@ -240,8 +366,9 @@ register_object (SpiRegister * reg, GObject * gobj)
 GObject *
 spi_register_path_to_object (SpiRegister * reg, const char *path)
 {
-  guint index;
-  void *data;
+  SpiRegisterSlot *slot;
+  gchar *end;
+  guint64 ref;
 
   g_return_val_if_fail (path, NULL);
 
@@ -252,13 +379,17 @@ spi_register_path_to_object (SpiRegister * reg, const char *path)
   path += SPI_ATK_PATH_PREFIX_LENGTH; /* Skip over the prefix */
 
   /* Map the root path to the root object. */
-  if (!g_strcmp0 (SPI_ATK_OBJECT_PATH_ROOT, path))
+  if (path[0] == SPI_ATK_OBJECT_PATH_ROOT[0] &&
+      !strcmp (SPI_ATK_OBJECT_PATH_ROOT, path))
     return G_OBJECT (spi_global_app_data->root);
 
-  index = atoi (path);
-  data = g_hash_table_lookup (reg->ref2ptr, GINT_TO_POINTER (index));
-  if (data)
-    return G_OBJECT(data);
+  ref = g_ascii_strtoull (path, &end, 10);
+  if (end == path || *end != '\0' || ref > G_MAXUINT)
+    return NULL;
+
+  slot = ref_to_slot (reg, (guint) ref);
+  if (slot)
+    return slot->gobj;
   else
     return NULL;
 }
@@ -274,10 +405,16 @@ spi_global_register_path_to_object (const char * path)
  * 
  * If the objects is not already registered, 
  * this function will register it.
+ *
+ * The returned string is owned by the register, or by the object once
+ * it has been deregistered, and stays valid while the object is alive.
+ * Objects deregistered while alive are not registered again.
  */
-gchar *
-spi_register_object_to_path (SpiRegister * reg, GObject * gobj)
+const gchar *
+spi_register_object_get_path (SpiRegister * reg, GObject * gobj)
 {
+  SpiRegisterSlot *slot;
+  gchar *path;
   guint ref;
 
   if (gobj == NULL)
@@ -285,19 +422,37 @@ spi_register_object_to_path (SpiRegister * reg, GObject * gobj)
 
   /* Map the root object to the root path. */
   if ((void *)gobj == (void *)spi_global_app_data->root)
-    return g_strdup (spi_register_root_path);
+    return spi_register_root_path;
 
   ref = object_to_ref (gobj);
   if (!ref)
     {
+      /* Objects deregistered while still alive keep their old path */
+      path = g_object_get_qdata (gobj, quark_dbus_path);
+      if (path)
+        return path;
+
       register_object (reg, gobj);
       ref = object_to_ref (gobj);
     }
 
   if (!ref)
     return NULL;
-  else
-    return ref_to_path (ref);
+
+  slot = ref_to_slot (reg, ref);
+  if (slot && slot->gobj == gobj)
+    return slot->path;
+  return NULL;
+}
+
+/*
+ * As spi_register_object_get_path, but returns a newly allocated copy
+ * of the path.
+ */
+gchar *
+spi_register_object_to_path (SpiRegister * reg, GObject * gobj)
+{
+  return g_strdup (spi_register_object_get_path (reg, gobj));
 }
 
 guint
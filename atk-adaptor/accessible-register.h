@@ -42,8 +42,11 @@ struct _SpiRegister
 {
   GObject parent;
 
-  GHashTable * ref2ptr;
-  guint reference_counter;
+  GArray * slots;
+  guint free_head;
+  guint free_tail;
+  guint n_free;
+  guint n_retired;
 };
 
 struct _SpiRegisterClass
@@ -66,6 +69,9 @@ spi_global_register_path_to_object (const char * path);
 gchar *
 spi_register_object_to_path (SpiRegister * reg, GObject * gobj);
 
+const gchar *
+spi_register_object_get_path (SpiRegister * reg, GObject * gobj);
+
 guint
 spi_register_object_to_ref (GObject * gobj);
   
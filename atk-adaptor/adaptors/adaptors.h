@@ -46,5 +46,12 @@ void spi_initialize_table_cell (DRoutePath * path);
 void spi_initialize_text (DRoutePath * path);
 void spi_initialize_value (DRoutePath * path);
 void spi_initialize_cache (DRoutePath * path);
+void spi_initialize_stats (DRoutePath * path);
+void spi_initialize_event_batch (DRoutePath * path);
+
+void spi_cache_item_invalidate (AtkObject * obj);
+void spi_cache_item_structure_changed (void);
+void spi_cache_item_memo_enable (gboolean enable);
+void spi_cache_exports_remove_client (const char *bus_name);
 
 #endif /* ADAPTORS_H */
@@ -30,10 +30,14 @@
 
 #include "spi-dbus.h"
 #include "accessible-stateset.h"
+#include "bitarray.h"
 #include "accessible-cache.h"
+#include "accessible-register.h"
 #include "bridge.h"
 #include "object.h"
 #include "introspection.h"
+#include "adaptors.h"
+#include "event.h"
 
 /* TODO - This should possibly be a common define */
 #define SPI_OBJECT_PREFIX "/org/a11y/atspi"
@@ -60,8 +64,182 @@
                                      DBUS_TYPE_UINT32_AS_STRING \
                                  ")"
 
+/*
+ * Clients that called EnableBatchedSignals receive the objects added to
+ * the cache during a population pass as a single AddAccessibles signal,
+ * which is sent once the pass yields to the main loop. The per-object
+ * AddAccessible signal is only sent while some client hasn't opted in;
+ * clients that opted in should ignore it.
+ *
+ * Once every client has opted in, removals are also held back until the
+ * main loop runs. A RemoveSubtree signal is then sent for each removed
+ * object whose parent wasn't removed along with it, rather than a
+ * RemoveAccessible signal for every object in the subtree.
+ *
+ * Only clients the bridge knows about count: those that registered an
+ * event listener or called a method on it. A client that merely watches
+ * the bus for cache signals stops getting the per-object ones once every
+ * known client has opted in, so such clients must call a method (eg.
+ * GetItems) before relying on them.
+ *
+ * pending_add_index maps the objects waiting in pending_adds to their
+ * index plus one, so that an object removed before the batch is sent can
+ * be taken out of it without searching. Its slot is left NULL.
+ */
+static GPtrArray *pending_adds = NULL;
+static GHashTable *pending_add_index = NULL;
+static GHashTable *pending_removes = NULL;
+static guint pending_idle = 0;
+
+/*
+ * Pending removals are keyed by register reference, as is their parent,
+ * since either object may be finalized before the removals are sent.
+ */
+typedef struct _PendingRemove
+{
+  guint parent;
+  gchar *path;
+} PendingRemove;
+
+/*
+ * The parts of a cache item that are expensive to work out (the state
+ * set, interfaces, name and so on) are remembered per object while the
+ * event listeners are registered, as those listeners tell us when they
+ * change. Index in parent and child count depend on the siblings and
+ * children too, so they are recomputed whenever children have changed
+ * anywhere since the item was remembered.
+ */
+typedef struct _CacheItemMemo
+{
+  guint structure_serial;
+  dbus_int32_t index;
+  dbus_int32_t count;
+  dbus_uint32_t role;
+  dbus_uint32_t states[2];
+  gchar *name;
+  gchar *desc;
+  guint n_interfaces;
+  const gchar *interfaces[SPI_OBJECT_MAX_INTERFACES];
+} CacheItemMemo;
+
+static GHashTable *item_memos = NULL;
+static guint structure_serial = 0;
+
 /*---------------------------------------------------------------------------*/
 
+static void
+cache_item_memo_free (CacheItemMemo *memo)
+{
+  g_free (memo->name);
+  g_free (memo->desc);
+  g_free (memo);
+}
+
+static void
+cache_item_memo_update_structure (CacheItemMemo *memo, AtkObject *obj)
+{
+  memo->index = (BITARRAY_TEST (memo->states, ATSPI_STATE_TRANSIENT)
+                 ? -1 : atk_object_get_index_in_parent (obj));
+
+  memo->count = (BITARRAY_TEST (memo->states, ATSPI_STATE_MANAGES_DESCENDANTS) ||
+                 BITARRAY_TEST (memo->states, ATSPI_STATE_DEFUNCT))
+                 ? -1 : atk_object_get_n_accessible_children (obj);
+  if (ATK_IS_SOCKET (obj) && atk_socket_is_occupied (ATK_SOCKET (obj)))
+    memo->count = 1;
+
+  memo->structure_serial = structure_serial;
+}
+
+static void
+cache_item_memo_fill (CacheItemMemo *memo, AtkObject *obj)
+{
+  AtkStateSet *set;
+  const char *str;
+
+  set = atk_object_ref_state_set (obj);
+  spi_atk_state_set_to_dbus_array (set, memo->states);
+  g_object_unref (set);
+
+  memo->role = spi_accessible_role_from_atk_role (atk_object_get_role (obj));
+  memo->n_interfaces = spi_object_get_interfaces (obj, memo->interfaces);
+
+  str = atk_object_get_name (obj);
+  memo->name = g_strdup (str ? str : "");
+  str = atk_object_get_description (obj);
+  memo->desc = g_strdup (str ? str : "");
+
+  cache_item_memo_update_structure (memo, obj);
+}
+
+/*
+ * Returns the memo for obj, computing it if needed. Objects outside the
+ * cache, and any object while the event listeners are not registered,
+ * get a fresh memo that the caller must free.
+ */
+static CacheItemMemo *
+cache_item_memo_get (AtkObject *obj, gboolean *temporary)
+{
+  CacheItemMemo *memo;
+
+  if (item_memos && spi_cache_in (spi_global_cache, G_OBJECT (obj)))
+    {
+      *temporary = FALSE;
+      memo = g_hash_table_lookup (item_memos, obj);
+      if (!memo)
+        {
+          memo = g_new0 (CacheItemMemo, 1);
+          cache_item_memo_fill (memo, obj);
+          g_hash_table_insert (item_memos, obj, memo);
+        }
+      else if (memo->structure_serial != structure_serial)
+        cache_item_memo_update_structure (memo, obj);
+      return memo;
+    }
+
+  *temporary = TRUE;
+  memo = g_new0 (CacheItemMemo, 1);
+  cache_item_memo_fill (memo, obj);
+  return memo;
+}
+
+/*
+ * Forgets what was remembered about obj, after a name, description, role,
+ * parent or state change.
+ */
+void
+spi_cache_item_invalidate (AtkObject *obj)
+{
+  if (item_memos)
+    g_hash_table_remove (item_memos, obj);
+}
+
+/*
+ * Marks index in parent and child count as stale for every object, after
+ * children were added or removed somewhere.
+ */
+void
+spi_cache_item_structure_changed (void)
+{
+  structure_serial++;
+}
+
+/*
+ * Memos are only kept while the event listeners that invalidate them are
+ * registered.
+ */
+void
+spi_cache_item_memo_enable (gboolean enable)
+{
+  if (enable && !item_memos)
+    item_memos = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify) cache_item_memo_free);
+  else if (!enable && item_memos)
+    {
+      g_hash_table_destroy (item_memos);
+      item_memos = NULL;
+    }
+}
+
 /*
  * Marshals the given AtkObject into the provided D-Bus iterator.
  *
@@ -72,15 +250,13 @@ static void
 append_cache_item (AtkObject * obj, gpointer data)
 {
   DBusMessageIter iter_struct, iter_sub_array;
-  dbus_uint32_t states[2];
-  dbus_int32_t count, index;
-  AtkStateSet *set;
   DBusMessageIter *iter_array = (DBusMessageIter *) data;
-  const char *name, *desc;
-  dbus_uint32_t role;
+  CacheItemMemo *memo;
+  gboolean temporary;
+  guint i;
+  AtkObject *application, *parent;
 
-  set = atk_object_ref_state_set (obj);
-    AtkObject *application, *parent;
+  memo = cache_item_memo_get (obj, &temporary);
 
   dbus_message_iter_open_container (iter_array, DBUS_TYPE_STRUCT, NULL,
                                     &iter_struct);
@@ -88,8 +264,6 @@ append_cache_item (AtkObject * obj, gpointer data)
   /* Marshal object path */
   spi_object_append_reference (&iter_struct, obj);
 
-  role = spi_accessible_role_from_atk_role (atk_object_get_role (obj));
-
   /* Marshal application */
   application = spi_global_app_data->root;
   spi_object_append_reference (&iter_struct, application);
@@ -128,7 +302,7 @@ append_cache_item (AtkObject * obj, gpointer data)
               spi_object_append_null_reference (&iter_struct);
             }
         }
-      else if (role != ATSPI_ROLE_APPLICATION)
+      else if (memo->role != ATSPI_ROLE_APPLICATION)
         spi_object_append_null_reference (&iter_struct);
       else
         spi_object_append_desktop_reference (&iter_struct);
@@ -139,84 +313,114 @@ append_cache_item (AtkObject * obj, gpointer data)
     }
 
   /* Marshal index in parent */
-  index = (atk_state_set_contains_state (set, ATK_STATE_TRANSIENT)
-           ? -1 : atk_object_get_index_in_parent (obj));
-  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_INT32, &index);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_INT32, &memo->index);
 
   /* marshal child count */
-  count = (atk_state_set_contains_state (set, ATK_STATE_MANAGES_DESCENDANTS) ||
-           atk_state_set_contains_state (set, ATK_STATE_DEFUNCT))
-           ? -1 : atk_object_get_n_accessible_children (obj);
-  if (ATK_IS_SOCKET (obj) && atk_socket_is_occupied (ATK_SOCKET (obj)))
-    count = 1;
-  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_INT32, &count);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_INT32, &memo->count);
 
   /* Marshal interfaces */
   dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "s",
                                     &iter_sub_array);
-  spi_object_append_interfaces (&iter_sub_array, obj);
+  for (i = 0; i < memo->n_interfaces; i++)
+    dbus_message_iter_append_basic (&iter_sub_array, DBUS_TYPE_STRING,
+                                    &memo->interfaces[i]);
   dbus_message_iter_close_container (&iter_struct, &iter_sub_array);
 
   /* Marshal name */
-  name = atk_object_get_name (obj);
-  if (!name)
-    name = "";
-  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &memo->name);
 
   /* Marshal role */
-  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_UINT32, &role);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_UINT32, &memo->role);
 
   /* Marshal description */
-  desc = atk_object_get_description (obj);
-  if (!desc)
-    desc = "";
-  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &desc);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &memo->desc);
 
   /* Marshal state set */
-  spi_atk_state_set_to_dbus_array (set, states);
   dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "u",
                                     &iter_sub_array);
-  for (count = 0; count < 2; count++)
+  for (i = 0; i < 2; i++)
     {
       dbus_message_iter_append_basic (&iter_sub_array, DBUS_TYPE_UINT32,
-                                      &states[count]);
+                                      &memo->states[i]);
     }
   dbus_message_iter_close_container (&iter_struct, &iter_sub_array);
 
   dbus_message_iter_close_container (iter_array, &iter_struct);
-  g_object_unref (set);
+
+  if (temporary)
+    cache_item_memo_free (memo);
 }
 
 /*---------------------------------------------------------------------------*/
 
-static void
-ref_accessible_hf (gpointer key, gpointer obj_data, gpointer data)
-{
-  g_object_ref (key);
-}
-
 /* For use as a GHFunc */
 static void
-append_accessible_hf (gpointer key, gpointer obj_data, gpointer data)
+snapshot_hf (gpointer key, gpointer obj_data, gpointer data)
 {
+  GPtrArray *snapshot = data;
+
   /* Make sure it isn't a hyperlink */
   if (ATK_IS_OBJECT (key))
-    append_cache_item (ATK_OBJECT (key), data);
+    g_ptr_array_add (snapshot, g_object_ref (key));
 }
 
-static void
-add_to_list_hf (gpointer key, gpointer obj_data, gpointer data)
+/*
+ * Takes a reference to every accessible in the cache, so that the set
+ * being exported can't change underneath us.
+ */
+static GPtrArray *
+snapshot_cache (void)
 {
-  GSList **listptr = data;
-  *listptr = g_slist_prepend (*listptr, key);
+  GPtrArray *snapshot;
+
+  snapshot = g_ptr_array_new_with_free_func (g_object_unref);
+  spi_cache_foreach (spi_global_cache, snapshot_hf, snapshot);
+  return snapshot;
 }
 
 /*---------------------------------------------------------------------------*/
 
+static void
+pending_remove_free (PendingRemove *remove)
+{
+  g_free (remove->path);
+  g_free (remove);
+}
+
+static void
+schedule_pending (void);
+
 static void
 emit_cache_remove (SpiCache *cache, GObject * obj)
 {
   DBusMessage *message;
+  guint index;
+  guint ref;
+
+  spi_cache_item_invalidate (ATK_OBJECT (obj));
+
+  /* Don't announce an object in a batch after it has been removed */
+  index = GPOINTER_TO_UINT (g_hash_table_lookup (pending_add_index, obj));
+  if (index)
+    {
+      g_hash_table_remove (pending_add_index, obj);
+      g_ptr_array_index (pending_adds, index - 1) = NULL;
+      g_object_unref (obj);
+    }
+
+  ref = spi_register_object_to_ref (obj);
+  if (ref && spi_atk_n_clients_with_flag (SPI_CLIENT_BATCHED_SIGNALS) &&
+      spi_atk_all_clients_have_flag (SPI_CLIENT_BATCHED_SIGNALS))
+    {
+      PendingRemove *remove = g_new (PendingRemove, 1);
+
+      /* obj is being deregistered, so record its path while it has one */
+      remove->parent = spi_cache_get_parent_ref (cache, obj);
+      remove->path = spi_register_object_to_path (spi_global_register, obj);
+      g_hash_table_insert (pending_removes, GUINT_TO_POINTER (ref), remove);
+      schedule_pending ();
+      return;
+    }
 
   if ((message = dbus_message_new_signal (SPI_CACHE_OBJECT_PATH,
                                           ATSPI_DBUS_INTERFACE_CACHE,
@@ -228,10 +432,108 @@ emit_cache_remove (SpiCache *cache, GObject * obj)
 
       spi_object_append_reference (&iter, ATK_OBJECT (obj));
 
-      dbus_connection_send (spi_global_app_data->bus, message, NULL);
+      spi_atk_schedule_signal (spi_global_app_data->bus, message);
+
+      dbus_message_unref (message);
+    }
+}
+
+static void
+emit_pending_removes (void)
+{
+  GHashTableIter iter;
+  PendingRemove *remove;
+  const char *name = dbus_bus_get_unique_name (spi_global_app_data->bus);
+
+  g_hash_table_iter_init (&iter, pending_removes);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &remove))
+    {
+      DBusMessage *message;
+
+      /* Covered by the removal of an ancestor */
+      if (remove->parent &&
+          g_hash_table_lookup_extended (pending_removes,
+                                        GUINT_TO_POINTER (remove->parent),
+                                        NULL, NULL))
+        continue;
+
+      if ((message = dbus_message_new_signal (SPI_CACHE_OBJECT_PATH,
+                                              ATSPI_DBUS_INTERFACE_CACHE,
+                                              "RemoveSubtree")))
+        {
+          DBusMessageIter iter_msg, iter_struct;
+
+          dbus_message_iter_init_append (message, &iter_msg);
+          dbus_message_iter_open_container (&iter_msg, DBUS_TYPE_STRUCT, NULL,
+                                            &iter_struct);
+          dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &name);
+          dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_OBJECT_PATH,
+                                          &remove->path);
+          dbus_message_iter_close_container (&iter_msg, &iter_struct);
+
+          spi_atk_schedule_signal (spi_global_app_data->bus, message);
+
+          dbus_message_unref (message);
+        }
+    }
+
+  g_hash_table_remove_all (pending_removes);
+}
+
+static void
+emit_pending_adds (void)
+{
+  DBusMessage *message;
+  guint i;
+
+  if (g_hash_table_size (pending_add_index) &&
+      (message = dbus_message_new_signal (SPI_CACHE_OBJECT_PATH,
+                                          ATSPI_DBUS_INTERFACE_CACHE,
+                                          "AddAccessibles")))
+    {
+      DBusMessageIter iter, iter_array;
+
+      dbus_message_iter_init_append (message, &iter);
+      dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                        SPI_CACHE_ITEM_SIGNATURE, &iter_array);
+      for (i = 0; i < pending_adds->len; i++)
+        {
+          AtkObject *accessible = g_ptr_array_index (pending_adds, i);
+
+          if (accessible)
+            append_cache_item (accessible, &iter_array);
+        }
+      dbus_message_iter_close_container (&iter, &iter_array);
+
+      spi_atk_schedule_signal (spi_global_app_data->bus, message);
 
       dbus_message_unref (message);
     }
+
+  for (i = 0; i < pending_adds->len; i++)
+    {
+      if (g_ptr_array_index (pending_adds, i))
+        g_object_unref (g_ptr_array_index (pending_adds, i));
+    }
+  g_ptr_array_set_size (pending_adds, 0);
+  g_hash_table_remove_all (pending_add_index);
+}
+
+static gboolean
+emit_pending (gpointer data)
+{
+  pending_idle = 0;
+
+  emit_pending_removes ();
+  emit_pending_adds ();
+  return FALSE;
+}
+
+static void
+schedule_pending (void)
+{
+  if (!pending_idle)
+    pending_idle = g_idle_add (emit_pending, NULL);
 }
 
 static void
@@ -240,6 +542,21 @@ emit_cache_add (SpiCache *cache, GObject * obj)
   AtkObject *accessible = ATK_OBJECT (obj);
   DBusMessage *message;
 
+  if (spi_atk_n_clients_with_flag (SPI_CLIENT_BATCHED_SIGNALS))
+    {
+      /* An object only goes in a batch once, so one index entry covers it */
+      if (!g_hash_table_lookup (pending_add_index, accessible))
+        {
+          g_ptr_array_add (pending_adds, g_object_ref (accessible));
+          g_hash_table_insert (pending_add_index, accessible,
+                               GUINT_TO_POINTER (pending_adds->len));
+          schedule_pending ();
+        }
+
+      if (spi_atk_all_clients_have_flag (SPI_CLIENT_BATCHED_SIGNALS))
+        return;
+    }
+
   if ((message = dbus_message_new_signal (SPI_CACHE_OBJECT_PATH,
                                           ATSPI_DBUS_INTERFACE_CACHE,
                                           "AddAccessible")))
@@ -251,13 +568,12 @@ emit_cache_add (SpiCache *cache, GObject * obj)
       append_cache_item (accessible, &iter);
       g_object_unref (accessible);
 
-      dbus_connection_send (spi_global_app_data->bus, message, NULL);
+      spi_atk_schedule_signal (spi_global_app_data->bus, message);
 
       dbus_message_unref (message);
     }
 }
 
-
 /*---------------------------------------------------------------------------*/
 
 static DBusMessage *
@@ -273,7 +589,8 @@ impl_GetItems (DBusConnection * bus, DBusMessage * message, void *user_data)
 {
   DBusMessage *reply;
   DBusMessageIter iter, iter_array;
-  GSList *pending_unrefs = NULL;
+  GPtrArray *snapshot;
+  guint i;
 
   if (bus == spi_global_app_data->bus)
     spi_atk_add_client (dbus_message_get_sender (message));
@@ -283,11 +600,263 @@ impl_GetItems (DBusConnection * bus, DBusMessage * message, void *user_data)
   dbus_message_iter_init_append (reply, &iter);
   dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
                                     SPI_CACHE_ITEM_SIGNATURE, &iter_array);
-  spi_cache_foreach (spi_global_cache, ref_accessible_hf, NULL);
-  spi_cache_foreach (spi_global_cache, append_accessible_hf, &iter_array);
-  spi_cache_foreach (spi_global_cache, add_to_list_hf, &pending_unrefs);
-  g_slist_free_full (pending_unrefs, g_object_unref);
+  snapshot = snapshot_cache ();
+  for (i = 0; i < snapshot->len; i++)
+    append_cache_item (g_ptr_array_index (snapshot, i), &iter_array);
+  g_ptr_array_free (snapshot, TRUE);
+  dbus_message_iter_close_container (&iter, &iter_array);
+  return reply;
+}
+
+/*
+ * GetItemsPaged returns the cache a page at a time. A cursor of 0 starts
+ * a new export from a snapshot of the cache membership, and each reply
+ * carries the cursor for the next page, or 0 once the export is complete.
+ * Objects removed from the cache after the snapshot was taken are skipped.
+ * Each client has at most one export, which starting another replaces.
+ * Exports that are left unfinished are dropped after a while, or when
+ * their client goes away.
+ */
+#define SPI_CACHE_PAGE_MAX       2000
+#define SPI_CACHE_EXPORT_TIMEOUT 30
+
+typedef struct _CacheExport
+{
+  guint cursor;
+  gchar *sender;
+  GPtrArray *snapshot;
+  guint position;
+  guint timeout;
+} CacheExport;
+
+static GHashTable *cache_exports = NULL;
+static GHashTable *sender_exports = NULL;
+static guint last_cursor = 0;
+
+static void
+cache_export_free (CacheExport *export)
+{
+  g_hash_table_remove (sender_exports, export->sender);
+  if (export->timeout)
+    g_source_remove (export->timeout);
+  g_ptr_array_free (export->snapshot, TRUE);
+  g_free (export->sender);
+  g_free (export);
+}
+
+static gboolean
+cache_export_expire (gpointer data)
+{
+  CacheExport *export = data;
+
+  export->timeout = 0;
+  g_hash_table_remove (cache_exports, GUINT_TO_POINTER (export->cursor));
+  return FALSE;
+}
+
+static CacheExport *
+cache_export_new (const char *sender)
+{
+  CacheExport *export;
+
+  export = g_hash_table_lookup (sender_exports, sender);
+  if (export)
+    g_hash_table_remove (cache_exports, GUINT_TO_POINTER (export->cursor));
+
+  export = g_new0 (CacheExport, 1);
+  do
+    {
+      if (++last_cursor == 0)
+        last_cursor++;
+    }
+  while (g_hash_table_lookup (cache_exports, GUINT_TO_POINTER (last_cursor)));
+  export->cursor = last_cursor;
+  export->sender = g_strdup (sender);
+  export->snapshot = snapshot_cache ();
+  g_hash_table_insert (cache_exports, GUINT_TO_POINTER (export->cursor), export);
+  g_hash_table_insert (sender_exports, export->sender, export);
+  return export;
+}
+
+/*
+ * Drops the export of a client that has gone away.
+ */
+void
+spi_cache_exports_remove_client (const char *bus_name)
+{
+  CacheExport *export;
+
+  if (!sender_exports)
+    return;
+
+  export = g_hash_table_lookup (sender_exports, bus_name);
+  if (export)
+    g_hash_table_remove (cache_exports, GUINT_TO_POINTER (export->cursor));
+}
+
+static DBusMessage *
+impl_GetItemsPaged (DBusConnection * bus, DBusMessage * message, void *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, iter_array;
+  CacheExport *export;
+  const char *sender = dbus_message_get_sender (message);
+  dbus_uint32_t cursor, count, next = 0;
+  guint end;
+
+  if (!dbus_message_get_args (message, NULL, DBUS_TYPE_UINT32, &cursor,
+                              DBUS_TYPE_UINT32, &count, DBUS_TYPE_INVALID))
+    return droute_invalid_arguments_error (message);
+
+  if (bus == spi_global_app_data->bus)
+    spi_atk_add_client (sender);
+
+  /* Peers on direct connections have no name, and share one export */
+  if (!sender)
+    sender = "";
+
+  if (cursor == 0)
+    export = cache_export_new (sender);
+  else
+    {
+      export = g_hash_table_lookup (cache_exports, GUINT_TO_POINTER (cursor));
+      if (!export || strcmp (export->sender, sender))
+        return dbus_message_new_error (message, DBUS_ERROR_INVALID_ARGS,
+                                       "Unknown or expired cursor");
+    }
+
+  count = CLAMP (count, 1, SPI_CACHE_PAGE_MAX);
+  end = MIN (export->position + count, export->snapshot->len);
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                    SPI_CACHE_ITEM_SIGNATURE, &iter_array);
+  for (; export->position < end; export->position++)
+    {
+      GObject *obj = g_ptr_array_index (export->snapshot, export->position);
+
+      if (spi_cache_in (spi_global_cache, obj))
+        append_cache_item (ATK_OBJECT (obj), &iter_array);
+    }
   dbus_message_iter_close_container (&iter, &iter_array);
+
+  if (export->position < export->snapshot->len)
+    {
+      next = export->cursor;
+      if (export->timeout)
+        g_source_remove (export->timeout);
+      export->timeout = g_timeout_add_seconds (SPI_CACHE_EXPORT_TIMEOUT,
+                                               cache_export_expire, export);
+    }
+  else
+    g_hash_table_remove (cache_exports, GUINT_TO_POINTER (export->cursor));
+
+  dbus_message_iter_append_basic (&iter, DBUS_TYPE_UINT32, &next);
+  return reply;
+}
+
+/*---------------------------------------------------------------------------*/
+
+static DBusMessage *
+impl_EnableBatchedSignals (DBusConnection * bus, DBusMessage * message, void *user_data)
+{
+  const char *sender = dbus_message_get_sender (message);
+
+  if (bus == spi_global_app_data->bus && sender)
+    {
+      spi_atk_add_client (sender);
+      spi_atk_set_client_flag (sender, SPI_CLIENT_BATCHED_SIGNALS);
+    }
+
+  return dbus_message_new_method_return (message);
+}
+
+/*---------------------------------------------------------------------------*/
+
+typedef struct _PropertyRequest
+{
+  const char *name;
+  DRoutePropertyFunction func;
+  GType type;
+} PropertyRequest;
+
+/*
+ * Fetch a list of properties from a list of objects in a single round trip.
+ * Property names are given as for Collection.GetTree, ie. "Name" or
+ * "component.Layer". Each object gets a dictionary holding the properties
+ * that apply to it; objects that no longer exist get an empty one.
+ */
+static DBusMessage *
+impl_GetProperties (DBusConnection * bus, DBusMessage * message, void *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, iter_paths, iter_props;
+  DBusMessageIter iter_array, iter_struct, iter_dict, iter_dict_entry;
+  GArray *requests;
+  gint i;
+
+  if (strcmp (dbus_message_get_signature (message), "aoas") != 0)
+    return droute_invalid_arguments_error (message);
+
+  dbus_message_iter_init (message, &iter);
+  dbus_message_iter_recurse (&iter, &iter_paths);
+  dbus_message_iter_next (&iter);
+  dbus_message_iter_recurse (&iter, &iter_props);
+
+  /* Resolve each property once rather than once per object */
+  requests = g_array_new (FALSE, FALSE, sizeof (PropertyRequest));
+  while (dbus_message_iter_get_arg_type (&iter_props) != DBUS_TYPE_INVALID)
+    {
+      PropertyRequest request;
+
+      dbus_message_iter_get_basic (&iter_props, &request.name);
+      request.func = _atk_bridge_find_property_func (request.name, &request.type);
+      if (request.func)
+        g_array_append_val (requests, request);
+      dbus_message_iter_next (&iter_props);
+    }
+
+  reply = dbus_message_new_method_return (message);
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(oa{sv})",
+                                    &iter_array);
+
+  while (dbus_message_iter_get_arg_type (&iter_paths) != DBUS_TYPE_INVALID)
+    {
+      const char *path;
+      GObject *obj;
+
+      dbus_message_iter_get_basic (&iter_paths, &path);
+      obj = spi_register_path_to_object (spi_global_register, path);
+
+      dbus_message_iter_open_container (&iter_array, DBUS_TYPE_STRUCT, NULL,
+                                        &iter_struct);
+      dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_OBJECT_PATH,
+                                      &path);
+      dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "{sv}",
+                                        &iter_dict);
+      for (i = 0; obj && i < requests->len; i++)
+        {
+          PropertyRequest *request = &g_array_index (requests, PropertyRequest, i);
+
+          if (!G_TYPE_CHECK_INSTANCE_TYPE (obj, request->type))
+            continue;
+          dbus_message_iter_open_container (&iter_dict, DBUS_TYPE_DICT_ENTRY,
+                                            NULL, &iter_dict_entry);
+          dbus_message_iter_append_basic (&iter_dict_entry, DBUS_TYPE_STRING,
+                                          &request->name);
+          request->func (&iter_dict_entry, obj);
+          dbus_message_iter_close_container (&iter_dict, &iter_dict_entry);
+        }
+      dbus_message_iter_close_container (&iter_struct, &iter_dict);
+      dbus_message_iter_close_container (&iter_array, &iter_struct);
+
+      dbus_message_iter_next (&iter_paths);
+    }
+
+  dbus_message_iter_close_container (&iter, &iter_array);
+  g_array_free (requests, TRUE);
   return reply;
 }
 
@@ -296,6 +865,9 @@ impl_GetItems (DBusConnection * bus, DBusMessage * message, void *user_data)
 static DRouteMethod methods[] = {
   {impl_GetRoot, "GetRoot"},
   {impl_GetItems, "GetItems"},
+  {impl_GetItemsPaged, "GetItemsPaged"},
+  {impl_GetProperties, "GetProperties"},
+  {impl_EnableBatchedSignals, "EnableBatchedSignals"},
   {NULL, NULL}
 };
 
@@ -304,6 +876,16 @@ spi_initialize_cache (DRoutePath * path)
 {
   droute_path_add_interface (path, ATSPI_DBUS_INTERFACE_CACHE, spi_org_a11y_atspi_Cache, methods, NULL);
 
+  pending_adds = g_ptr_array_new ();
+  pending_add_index = g_hash_table_new (g_direct_hash, g_direct_equal);
+  pending_removes = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                           NULL,
+                                           (GDestroyNotify) pending_remove_free);
+  cache_exports = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                         NULL,
+                                         (GDestroyNotify) cache_export_free);
+  sender_exports = g_hash_table_new (g_str_hash, g_str_equal);
+
   g_signal_connect (spi_global_cache, "object-added",
                     (GCallback) emit_cache_add, NULL);
 
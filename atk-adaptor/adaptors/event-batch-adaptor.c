@@ -0,0 +1,97 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Lets clients ask for the events raised during a main loop iteration to
+ * be sent to them as a single EventBatch signal, which happens once every
+ * client has asked. The EventQueue interface's EventsDropped signal, sent
+ * to every client whether or not it asked, tells how many events were
+ * dropped because clients weren't keeping up. See event.c.
+ */
+
+#include <atk/atk.h>
+#include <droute/droute.h>
+
+#include "spi-dbus.h"
+#include "event.h"
+
+/* for spi_global_app_data  is there a better way? */
+#include "../bridge.h"
+
+static const char *spi_org_a11y_atspi_EventBatch =
+"<interface name=\"org.a11y.atspi.EventBatch\">"
+""
+"  <method name=\"Enable\">"
+"  </method>"
+""
+"  <signal name=\"EventBatch\">"
+"    <arg name=\"events\" type=\"a(osssiiva{sv})\" />"
+"  </signal>"
+""
+"</interface>"
+"";
+
+static const char *spi_org_a11y_atspi_EventQueue =
+"<interface name=\"org.a11y.atspi.EventQueue\">"
+""
+"  <signal name=\"EventsDropped\">"
+"    <arg name=\"count\" type=\"u\" />"
+"  </signal>"
+""
+"</interface>"
+"";
+
+static DBusMessage *
+impl_Enable (DBusConnection * bus, DBusMessage * message, void *user_data)
+{
+  const char *sender = dbus_message_get_sender (message);
+
+  if (bus == spi_global_app_data->bus && sender)
+    {
+      spi_atk_add_client (sender);
+      spi_atk_set_client_flag (sender, SPI_CLIENT_EVENT_BATCH);
+    }
+
+  return dbus_message_new_method_return (message);
+}
+
+static DRouteMethod methods[] = {
+  {impl_Enable, "Enable"},
+  {NULL, NULL}
+};
+
+static DRouteProperty properties[] = {
+  {NULL, NULL, NULL}
+};
+
+void
+spi_initialize_event_batch (DRoutePath * path)
+{
+  droute_path_add_interface (path,
+                             SPI_DBUS_INTERFACE_EVENT_BATCH,
+                             spi_org_a11y_atspi_EventBatch,
+                             methods, properties);
+  droute_path_add_interface (path,
+                             SPI_DBUS_INTERFACE_EVENT_QUEUE,
+                             spi_org_a11y_atspi_EventQueue,
+                             NULL, properties);
+};
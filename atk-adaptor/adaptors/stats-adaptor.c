@@ -0,0 +1,257 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Debugging interface reporting what the bridge has been doing.
+ *
+ * GetCounters returns named counters, each of which only ever grows apart
+ * from the sizes of the cache, register, lease queue and event queue:
+ *
+ *   events.<class>.<type>.received  ATK signals passed to the bridge
+ *   events.<class>.<type>.emitted   AT-SPI signals sent for them
+ *   calls.<interface>.<member>      method calls handled
+ *   calls.<interface>.<member>.us   time spent handling them
+ *   events.queue.*                  events held back, coalesced, dropped,
+ *                                   and signals exempt from dropping
+ *   cache.size, register.size, leases.*, bytes.*, keys.timeouts
+ *
+ * Measuring the size of a message means marshalling a copy of it, so the
+ * bytes.* counters only start counting at the first GetCounters call, or
+ * from startup when AT_SPI_COUNT_BYTES is set.
+ *
+ * GetHistograms returns the key event latency histograms, whose first
+ * bucket counts replies within 64 us and each further bucket doubles that.
+ */
+
+#include <string.h>
+
+#include <atk/atk.h>
+#include <droute/droute.h>
+
+#include "spi-dbus.h"
+#include "accessible-cache.h"
+#include "accessible-leasing.h"
+#include "accessible-register.h"
+#include "event.h"
+
+/* for spi_global_app_data  is there a better way? */
+#include "../bridge.h"
+
+static const char *spi_org_a11y_atspi_BridgeStats =
+"<interface name=\"org.a11y.atspi.BridgeStats\">"
+""
+"  <method name=\"GetCounters\">"
+"    <arg direction=\"out\" name=\"counters\" type=\"a{st}\" />"
+"  </method>"
+""
+"  <method name=\"GetHistograms\">"
+"    <arg direction=\"out\" name=\"histograms\" type=\"a{sat}\" />"
+"  </method>"
+""
+"</interface>"
+"";
+
+/* The prefix shared by the event interfaces, "org.a11y.atspi.Event." */
+#define EVENT_INTERFACE_PREFIX_LEN 21
+
+static void
+append_counter (DBusMessageIter * iter, const char *name, guint64 value)
+{
+  DBusMessageIter iter_entry;
+  dbus_uint64_t v = value;
+
+  dbus_message_iter_open_container (iter, DBUS_TYPE_DICT_ENTRY, NULL,
+                                    &iter_entry);
+  dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_UINT64, &v);
+  dbus_message_iter_close_container (iter, &iter_entry);
+}
+
+static void
+append_event_counters (const gchar * klass, const gchar * major,
+                       guint64 received, guint64 emitted, gpointer user_data)
+{
+  DBusMessageIter *iter = user_data;
+  gchar *name;
+
+  if (strlen (klass) > EVENT_INTERFACE_PREFIX_LEN)
+    klass += EVENT_INTERFACE_PREFIX_LEN;
+
+  name = g_strdup_printf ("events.%s.%s.received", klass, major);
+  append_counter (iter, name, received);
+  g_free (name);
+
+  name = g_strdup_printf ("events.%s.%s.emitted", klass, major);
+  append_counter (iter, name, emitted);
+  g_free (name);
+}
+
+static void
+append_call_counters (const char *interface, const char *member,
+                      guint64 calls, guint64 time_us, void *user_data)
+{
+  DBusMessageIter *iter = user_data;
+  gchar *name;
+
+  name = g_strdup_printf ("calls.%s.%s", interface, member);
+  append_counter (iter, name, calls);
+  g_free (name);
+
+  name = g_strdup_printf ("calls.%s.%s.us", interface, member);
+  append_counter (iter, name, time_us);
+  g_free (name);
+}
+
+static void
+count_bytes (void)
+{
+  droute_context_set_count_bytes (spi_global_app_data->droute, TRUE);
+  spi_dbus_set_count_bytes (TRUE);
+}
+
+static DBusMessage *
+impl_GetCounters (DBusConnection * bus, DBusMessage * message,
+                  void *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, iter_dict;
+  SpiLeasingStats leasing;
+  SpiKeyLatencyStats keys;
+  SpiEventQueueStats queue;
+  guint64 replies = droute_context_get_bytes_sent (spi_global_app_data->droute);
+  guint64 signals = spi_dbus_get_bytes_sent ();
+
+  count_bytes ();
+
+  reply = dbus_message_new_method_return (message);
+  if (!reply)
+    return NULL;
+
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{st}",
+                                    &iter_dict);
+
+  spi_atk_foreach_event_stats (append_event_counters, &iter_dict);
+  spi_atk_get_event_queue_stats (&queue);
+  append_counter (&iter_dict, "events.queue.held", queue.n_held);
+  append_counter (&iter_dict, "events.queue.coalesced", queue.n_coalesced);
+  append_counter (&iter_dict, "events.queue.dropped", queue.n_dropped);
+  append_counter (&iter_dict, "events.queue.exempt", queue.n_exempt);
+  droute_context_foreach_call_stats (spi_global_app_data->droute,
+                                     append_call_counters, &iter_dict);
+
+  append_counter (&iter_dict, "cache.size",
+                  spi_global_cache ?
+                  g_hash_table_size (spi_global_cache->objects) : 0);
+  append_counter (&iter_dict, "register.size",
+                  spi_global_register->slots->len -
+                  spi_global_register->n_free -
+                  spi_global_register->n_retired);
+  append_counter (&iter_dict, "register.slots",
+                  spi_global_register->slots->len);
+  append_counter (&iter_dict, "register.retired",
+                  spi_global_register->n_retired);
+
+  spi_leasing_get_stats (spi_global_leasing, &leasing);
+  append_counter (&iter_dict, "leases.size", leasing.n_leases);
+  append_counter (&iter_dict, "leases.max", leasing.max_leases);
+  append_counter (&iter_dict, "leases.time_s", leasing.lease_time_s);
+  append_counter (&iter_dict, "leases.taken", leasing.n_taken);
+  append_counter (&iter_dict, "leases.renewed", leasing.n_renewed);
+  append_counter (&iter_dict, "leases.client_hits", leasing.n_client_hits);
+  append_counter (&iter_dict, "leases.expired", leasing.n_expired);
+  append_counter (&iter_dict, "leases.evicted", leasing.n_evicted);
+
+  append_counter (&iter_dict, "bytes.replies", replies);
+  append_counter (&iter_dict, "bytes.signals", signals);
+  append_counter (&iter_dict, "bytes.sent", replies + signals);
+
+  spi_atk_get_key_latency_stats (&keys);
+  append_counter (&iter_dict, "keys.timeouts", keys.n_timeouts);
+
+  dbus_message_iter_close_container (&iter, &iter_dict);
+  return reply;
+}
+
+static void
+append_histogram (DBusMessageIter * iter, const char *name,
+                  const guint64 * buckets, gint n_buckets)
+{
+  DBusMessageIter iter_entry, iter_array;
+
+  dbus_message_iter_open_container (iter, DBUS_TYPE_DICT_ENTRY, NULL,
+                                    &iter_entry);
+  dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_STRING, &name);
+  dbus_message_iter_open_container (&iter_entry, DBUS_TYPE_ARRAY, "t",
+                                    &iter_array);
+  dbus_message_iter_append_fixed_array (&iter_array, DBUS_TYPE_UINT64,
+                                        &buckets, n_buckets);
+  dbus_message_iter_close_container (&iter_entry, &iter_array);
+  dbus_message_iter_close_container (iter, &iter_entry);
+}
+
+static DBusMessage *
+impl_GetHistograms (DBusConnection * bus, DBusMessage * message,
+                    void *user_data)
+{
+  DBusMessage *reply;
+  DBusMessageIter iter, iter_dict;
+  SpiKeyLatencyStats keys;
+
+  reply = dbus_message_new_method_return (message);
+  if (!reply)
+    return NULL;
+
+  spi_atk_get_key_latency_stats (&keys);
+
+  dbus_message_iter_init_append (reply, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "{sat}",
+                                    &iter_dict);
+  append_histogram (&iter_dict, "keys.sync", keys.sync,
+                    SPI_KEY_LATENCY_BUCKETS);
+  append_histogram (&iter_dict, "keys.async", keys.async,
+                    SPI_KEY_LATENCY_BUCKETS);
+  dbus_message_iter_close_container (&iter, &iter_dict);
+  return reply;
+}
+
+static DRouteMethod methods[] = {
+  {impl_GetCounters, "GetCounters"},
+  {impl_GetHistograms, "GetHistograms"},
+  {NULL, NULL}
+};
+
+static DRouteProperty properties[] = {
+  {NULL, NULL, NULL}
+};
+
+void
+spi_initialize_stats (DRoutePath * path)
+{
+  droute_path_add_interface (path,
+                             SPI_DBUS_INTERFACE_BRIDGE_STATS,
+                             spi_org_a11y_atspi_BridgeStats,
+                             methods, properties);
+
+  if (g_getenv ("AT_SPI_COUNT_BYTES"))
+    count_bytes ();
+};
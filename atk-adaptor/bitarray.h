@@ -29,4 +29,5 @@
 #define BITARRAY_SEQ_TERM 0xffffffff
 
 #define BITARRAY_SET(p, n) ((p)[n>>5] |= (1<<(n&31)))
+#define BITARRAY_TEST(p, n) (((p)[n>>5] & (1<<(n&31))) != 0)
 #endif	/* _BITARRAY_H */
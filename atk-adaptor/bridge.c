@@ -46,8 +46,10 @@
 #include "accessible-register.h"
 #include "accessible-leasing.h"
 #include "accessible-cache.h"
+#include "keystroke-listeners.h"
 
 #include "spi-dbus.h"
+#include "spi-trace.h"
 
 /*---------------------------------------------------------------------------*/
 
@@ -78,10 +80,42 @@ add_event (const char *bus_name, const char *event)
   evdata->bus_name = g_strdup (bus_name);
   evdata->data = data;
   spi_global_app_data->events = g_list_append (spi_global_app_data->events, evdata);
+  spi_atk_event_subscriptions_changed ();
   return evdata;
 }
 
+typedef struct _SpiClient SpiClient;
+struct _SpiClient
+{
+  gchar *bus_name;
+  guint flags;
+};
+
 static GSList *clients = NULL;
+static guint n_clients = 0;
+static guint n_clients_with_flag[SPI_CLIENT_N_FLAGS];
+
+static void
+client_free (SpiClient *client)
+{
+  g_free (client->bus_name);
+  g_slice_free (SpiClient, client);
+}
+
+static GSList *
+find_client (const char *bus_name)
+{
+  GSList *l;
+
+  for (l = clients; l; l = l->next)
+  {
+    SpiClient *client = l->data;
+
+    if (!g_strcmp0 (client->bus_name, bus_name))
+      return l;
+  }
+  return NULL;
+}
 
 static void
 tally_event_reply ()
@@ -202,6 +236,7 @@ add_property_to_event (event_data *evdata, const char *property)
 
   prop->name = g_strdup (property);
   evdata->properties = g_slist_append (evdata->properties, prop);
+  spi_atk_event_subscriptions_changed ();
 }
 
 static void
@@ -278,6 +313,10 @@ get_device_events_reply (DBusPendingCall *pending, void *user_data)
       goto done;
     }
 
+  if (!strcmp (dbus_message_get_signature (reply),
+               "a" SPI_KEYSTROKE_LISTENER_SIGNATURE))
+    spi_keystroke_listeners_set_known ();
+
   dbus_message_iter_init (reply, &iter);
   dbus_message_iter_recurse (&iter, &iter_array);
   while (dbus_message_iter_get_arg_type (&iter_array) != DBUS_TYPE_INVALID)
@@ -286,6 +325,7 @@ get_device_events_reply (DBusPendingCall *pending, void *user_data)
       dbus_message_iter_recurse (&iter_array, &iter_struct);
       dbus_message_iter_get_basic (&iter_struct, &bus_name);
       spi_atk_add_client (bus_name);
+      spi_keystroke_listeners_add (&iter_array);
       dbus_message_iter_next (&iter_array);
     }
 
@@ -700,6 +740,20 @@ introspect_children_cb (const char *path, void *data)
   return NULL;
 }
 
+/*
+ * Resolves the object a client call is made on, letting the leasing know
+ * the object is still of interest.
+ */
+static GObject *
+get_accessible_for_path (const char *path)
+{
+  GObject *obj = spi_global_register_path_to_object (path);
+
+  if (obj)
+    spi_leasing_touch (spi_global_leasing, obj);
+  return obj;
+}
+
 static void
 handle_event_listener_registered (DBusConnection *bus, DBusMessage *message,
                                   void *user_data)
@@ -746,6 +800,7 @@ remove_events (const char *bus_name, const char *event)
           spi_event_is_subtype (evdata->data, remove_data))
         {
           GList *events = spi_global_app_data->events;
+          spi_atk_event_subscriptions_changed ();
           g_strfreev (evdata->data);
           g_free (evdata->bus_name);
           g_slist_free_full (evdata->properties, free_property_definition);
@@ -802,6 +857,17 @@ handle_device_listener_registered (DBusConnection *bus, DBusMessage *message,
   dbus_message_iter_recurse (&iter, &iter_struct);
   dbus_message_iter_get_basic (&iter_struct, &sender);
   spi_atk_add_client (sender);
+  spi_keystroke_listeners_add (&iter);
+}
+
+static void
+handle_device_listener_deregistered (DBusConnection *bus, DBusMessage *message,
+                                     void *user_data)
+{
+  DBusMessageIter iter;
+
+  dbus_message_iter_init (message, &iter);
+  spi_keystroke_listeners_remove (&iter);
 }
 
 static DBusHandlerResult
@@ -832,6 +898,8 @@ signal_filter (DBusConnection *bus, DBusMessage *message, void *user_data)
         handle_device_listener_registered (bus, message, user_data);
       else if (!strcmp (member, "DeviceListenerRegistered"))
         handle_device_listener_registered (bus, message, user_data);
+      else if (!strcmp (member, "KeystrokeListenerDeregistered"))
+        handle_device_listener_deregistered (bus, message, user_data);
       else
         result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
     }
@@ -854,7 +922,10 @@ signal_filter (DBusConnection *bus, DBusMessage *message, void *user_data)
                   registry_lost = FALSE;
                 }
               else if (!new[0])
-                registry_lost = TRUE;
+                {
+                  registry_lost = TRUE;
+                  spi_keystroke_listeners_reset ();
+                }
             }
           else if (*old != '\0' && *new == '\0')
               spi_atk_remove_client (old);
@@ -934,6 +1005,18 @@ check_envvar (void)
     return TRUE;
 }
 
+/*
+ * Adds the calls timed by droute to the trace. The names belong to the
+ * droute context, which is freed before the trace is written at exit.
+ */
+static void
+trace_droute_span (const char *name, const char *category,
+                   gint64 start_us, gint64 end_us, void *user_data)
+{
+  spi_trace_record (g_intern_string (name), g_intern_string (category),
+                    NULL, start_us, end_us);
+}
+
 void
 spi_atk_activate ()
 {
@@ -976,7 +1059,7 @@ atk_bridge_adaptor_init (gint * argc, gchar ** argv[])
   DBusError error;
   AtkObject *root;
   gboolean load_bridge;
-  DRoutePath *accpath;
+  DRoutePath *accpath, *bridgepath;
 
   load_bridge = check_envvar ();
   if (inited && !load_bridge)
@@ -1055,13 +1138,18 @@ atk_bridge_adaptor_init (gint * argc, gchar ** argv[])
   spi_global_app_data->droute =
     droute_new ();
 
+  spi_trace_init ();
+  if (spi_trace_active)
+    droute_context_set_span_func (spi_global_app_data->droute,
+                                  trace_droute_span, NULL);
+
   accpath = droute_add_many (spi_global_app_data->droute,
                              "/org/a11y/atspi/accessible",
                              NULL,
                              introspect_children_cb,
                              NULL,
                              (DRouteGetDatumFunction)
-                             spi_global_register_path_to_object);
+                             get_accessible_for_path);
 
 
   /* Register all interfaces with droute and set up application accessible db */
@@ -1082,6 +1170,11 @@ atk_bridge_adaptor_init (gint * argc, gchar ** argv[])
   spi_initialize_text (accpath);
   spi_initialize_value (accpath);
 
+  bridgepath = droute_add_one (spi_global_app_data->droute,
+                               SPI_DBUS_PATH_BRIDGE, NULL);
+  spi_initialize_stats (bridgepath);
+  spi_initialize_event_batch (bridgepath);
+
   droute_context_register (spi_global_app_data->droute,
                            spi_global_app_data->bus);
 
@@ -1151,9 +1244,11 @@ atk_bridge_adaptor_cleanup (void)
   spi_global_app_data->direct_connections = NULL;
 
   for (ls = clients; ls; ls = ls->next)
-    g_free (ls->data);
+    client_free (ls->data);
   g_slist_free (clients);
   clients = NULL;
+  n_clients = 0;
+  memset (n_clients_with_flag, 0, sizeof (n_clients_with_flag));
 
   g_clear_object (&spi_global_cache);
   g_clear_object (&spi_global_leasing);
@@ -1178,47 +1273,96 @@ static gchar *name_match_tmpl =
 void
 spi_atk_add_client (const char *bus_name)
 {
-  GSList *l;
+  SpiClient *client;
   gchar *match;
 
-  for (l = clients; l; l = l->next)
-  {
-    if (!g_strcmp0 (l->data, bus_name))
-      return;
-  }
+  if (find_client (bus_name))
+    return;
   if (!clients)
     spi_atk_activate ();
-  clients = g_slist_append (clients, g_strdup (bus_name));
+  client = g_slice_new0 (SpiClient);
+  client->bus_name = g_strdup (bus_name);
+  clients = g_slist_append (clients, client);
+  n_clients++;
   match = g_strdup_printf (name_match_tmpl, bus_name);
   dbus_bus_add_match (spi_global_app_data->bus, match, NULL);
   g_free (match);
 }
 
+gboolean
+spi_atk_has_client (const char *bus_name)
+{
+  return find_client (bus_name) != NULL;
+}
+
+guint
+spi_atk_n_clients (void)
+{
+  return n_clients;
+}
+
+/*
+ * Records that a known client opted in to something. The flag goes away
+ * with the client.
+ */
+void
+spi_atk_set_client_flag (const char *bus_name, SpiClientFlag flag)
+{
+  GSList *l = find_client (bus_name);
+  SpiClient *client;
+
+  if (!l)
+    return;
+
+  client = l->data;
+  if (!(client->flags & (1 << flag)))
+  {
+    client->flags |= 1 << flag;
+    n_clients_with_flag[flag]++;
+  }
+}
+
+guint
+spi_atk_n_clients_with_flag (SpiClientFlag flag)
+{
+  return n_clients_with_flag[flag];
+}
+
+gboolean
+spi_atk_all_clients_have_flag (SpiClientFlag flag)
+{
+  return n_clients_with_flag[flag] == n_clients;
+}
+
 void
 spi_atk_remove_client (const char *bus_name)
 {
   GSList *l;
-  GSList *next_node;
+  SpiClient *client;
+  gchar *match;
+  gint flag;
 
-  l = clients;
-  while (l)
-  {
-    next_node = l->next;
+  spi_keystroke_listeners_remove_bus (bus_name);
+  spi_cache_exports_remove_client (bus_name);
 
-    if (!g_strcmp0 (l->data, bus_name))
-    {
-      gchar *match = g_strdup_printf (name_match_tmpl, l->data);
-      dbus_bus_remove_match (spi_global_app_data->bus, match, NULL);
-  g_free (match);
-      g_free (l->data);
-      clients = g_slist_delete_link (clients, l);
-      if (!clients)
-        spi_atk_deregister_event_listeners ();
-      return;
-    }
+  l = find_client (bus_name);
+  if (!l)
+    return;
 
-    l = next_node;
+  client = l->data;
+  match = g_strdup_printf (name_match_tmpl, client->bus_name);
+  dbus_bus_remove_match (spi_global_app_data->bus, match, NULL);
+  g_free (match);
+  for (flag = 0; flag < SPI_CLIENT_N_FLAGS; flag++)
+  {
+    if (client->flags & (1 << flag))
+      n_clients_with_flag[flag]--;
   }
+  client_free (client);
+  clients = g_slist_delete_link (clients, l);
+  n_clients--;
+  if (!clients)
+    spi_atk_deregister_event_listeners ();
 }
 
 void
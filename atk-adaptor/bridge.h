@@ -77,8 +77,21 @@ gchar *app_bus_addr;
 
 extern SpiBridge *spi_global_app_data;
 
+/* Things a client can opt in to, which the bridge keeps count of */
+typedef enum
+{
+  SPI_CLIENT_BATCHED_SIGNALS,   /* called Cache.EnableBatchedSignals */
+  SPI_CLIENT_EVENT_BATCH,       /* called EventBatch.Enable */
+  SPI_CLIENT_N_FLAGS
+} SpiClientFlag;
+
 void spi_atk_add_client (const char *bus_name);
 void spi_atk_remove_client (const char *bus_name);
+gboolean spi_atk_has_client (const char *bus_name);
+guint spi_atk_n_clients (void);
+void spi_atk_set_client_flag (const char *bus_name, SpiClientFlag flag);
+guint spi_atk_n_clients_with_flag (SpiClientFlag flag);
+gboolean spi_atk_all_clients_have_flag (SpiClientFlag flag);
 
 int spi_atk_create_socket (SpiBridge *app);
 
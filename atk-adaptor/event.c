@@ -23,6 +23,7 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
@@ -31,11 +32,16 @@
 #include <atspi/atspi.h>
 
 #include "bridge.h"
+#include "accessible-cache.h"
 #include "accessible-register.h"
 
 #include "spi-dbus.h"
+#include "spi-probes.h"
+#include "spi-trace.h"
 #include "event.h"
 #include "object.h"
+#include "adaptors.h"
+#include "keystroke-listeners.h"
 
 static GArray *listener_ids = NULL;
 
@@ -49,6 +55,8 @@ static gint atk_bridge_focus_tracker_id;
 #define ITF_EVENT_DOCUMENT "org.a11y.atspi.Event.Document"
 #define ITF_EVENT_FOCUS    "org.a11y.atspi.Event.Focus"
 
+#define PCHANGE "PropertyChange"
+
 /*---------------------------------------------------------------------------*/
 
 typedef struct _SpiReentrantCallClosure 
@@ -134,24 +142,157 @@ send_and_allow_reentry (DBusConnection * bus, DBusMessage * message)
  * This is used for forwarding key events on to the registry daemon.
  */
 
+/*
+ * Key events normally block the application until the registry says
+ * whether a listener consumed them. Key events that no registered
+ * listener could match aren't sent at all. With AT_SPI_ASYNC_KEYS set,
+ * key events are only sent that way if a listener that may consume them
+ * matches; otherwise they are sent without waiting for the answer, and
+ * several may be in flight at once.
+ *
+ * The time taken by each key event, from sending it to the registry's
+ * reply, is recorded in a histogram for each of the two ways of sending
+ * it. Bucket 0 counts replies within 64 us, and each further bucket
+ * doubles that, the last one counting everything slower.
+ */
+static SpiKeyLatencyStats key_latency;
+
+/*
+ * Counts of the events handed to emit_event and of the signals emitted for
+ * them, for each event class and major type. They are keyed by the quarks
+ * signal_is_needed looks the names up by, so that counting costs a single
+ * lookup. Class names are the D-Bus interfaces of the signals and are all
+ * constant strings.
+ */
+typedef struct _SpiEventStats SpiEventStats;
+struct _SpiEventStats
+{
+  guint64 key;
+  const gchar *klass;
+  gchar *major;
+  guint64 received;
+  guint64 emitted;
+};
+
+#define EVENT_STATS_KEY(klass, major) (((guint64) (klass) << 32) | (major))
+
+static GHashTable *event_stats = NULL;
+
+static void
+event_stats_free (SpiEventStats *stats)
+{
+  g_free (stats->major);
+  g_free (stats);
+}
+
+static SpiEventStats *
+get_event_stats (const GQuark *names, const char *klass, const char *major)
+{
+  guint64 key = EVENT_STATS_KEY (names [0], names [1]);
+  SpiEventStats *stats;
+
+  if (!event_stats)
+    event_stats = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL,
+                                         (GDestroyNotify) event_stats_free);
+
+  stats = g_hash_table_lookup (event_stats, &key);
+  if (!stats)
+    {
+      stats = g_new0 (SpiEventStats, 1);
+      stats->key = key;
+      stats->klass = klass;
+      stats->major = g_strdup (major);
+      g_hash_table_insert (event_stats, &stats->key, stats);
+    }
+  return stats;
+}
+
+void
+spi_atk_foreach_event_stats (SpiEventStatsFunc func, gpointer user_data)
+{
+  GHashTableIter iter;
+  SpiEventStats *stats;
+
+  if (!event_stats)
+    return;
+
+  g_hash_table_iter_init (&iter, event_stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+    func (stats->klass, stats->major, stats->received, stats->emitted,
+          user_data);
+}
+
 static gboolean
-Accessibility_DeviceEventController_NotifyListenersSync (const
-                                                         AtspiDeviceEvent
-                                                         * key_event)
+async_keys_enabled (void)
+{
+  static gint enabled = -1;
+
+  if (enabled < 0)
+    {
+      const gchar *envvar = g_getenv ("AT_SPI_ASYNC_KEYS");
+
+      enabled = (envvar && atoi (envvar) == 1);
+    }
+  return enabled;
+}
+
+/* Returns the time in microseconds since start, for the probes */
+static gint64
+record_key_latency (guint64 *histogram, gint64 start)
+{
+  gint64 elapsed = g_get_monotonic_time () - start;
+  gint64 n;
+  guint bucket = 0;
+
+  for (n = elapsed / 64; n > 0 && bucket < SPI_KEY_LATENCY_BUCKETS - 1;
+       n /= 2)
+    bucket++;
+  histogram[bucket]++;
+  return elapsed;
+}
+
+void
+spi_atk_get_key_latency_stats (SpiKeyLatencyStats *stats)
+{
+  *stats = key_latency;
+}
+
+static DBusMessage *
+new_notify_listeners_message (const AtspiDeviceEvent *key_event)
 {
   DBusMessage *message;
-  dbus_bool_t consumed = FALSE;
 
   message =
     dbus_message_new_method_call (SPI_DBUS_NAME_REGISTRY,
                                   ATSPI_DBUS_PATH_DEC,
                                   ATSPI_DBUS_INTERFACE_DEC,
                                   "NotifyListenersSync");
+  if (message && !spi_dbus_marshal_deviceEvent (message, key_event))
+    {
+      dbus_message_unref (message);
+      return NULL;
+    }
+  return message;
+}
+
+static gboolean
+Accessibility_DeviceEventController_NotifyListenersSync (const
+                                                         AtspiDeviceEvent
+                                                         * key_event)
+{
+  DBusMessage *message;
+  dbus_bool_t consumed = FALSE;
+  gint64 start, elapsed;
 
-  if (spi_dbus_marshal_deviceEvent (message, key_event))
+  message = new_notify_listeners_message (key_event);
+  if (message)
     {
-      DBusMessage *reply =
-        send_and_allow_reentry (spi_global_app_data->bus, message);
+      DBusMessage *reply;
+
+      SPI_PROBE3 (key_start, key_event->type, key_event->id, TRUE);
+      start = g_get_monotonic_time ();
+      reply = send_and_allow_reentry (spi_global_app_data->bus, message);
+      elapsed = record_key_latency (key_latency.sync, start);
       if (reply)
         {
           DBusError error;
@@ -164,11 +305,65 @@ Accessibility_DeviceEventController_NotifyListenersSync (const
             }
           dbus_message_unref (reply);
         }
+      else
+        key_latency.n_timeouts++;
+      dbus_message_unref (message);
+      SPI_PROBE4 (key_finish, key_event->id, consumed, elapsed, TRUE);
     }
-  dbus_message_unref (message);
   return consumed;
 }
 
+typedef struct _PendingKey PendingKey;
+struct _PendingKey
+{
+  gint64 start;
+  dbus_int32_t id;
+};
+
+static void
+notify_listeners_reply (DBusPendingCall *pending, void *user_data)
+{
+  DBusMessage *reply = dbus_pending_call_steal_reply (pending);
+  PendingKey *key = user_data;
+  gint64 elapsed;
+
+  elapsed = record_key_latency (key_latency.async, key->start);
+  if (!reply || dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR)
+    key_latency.n_timeouts++;
+  SPI_PROBE4 (key_finish, key->id, FALSE, elapsed, FALSE);
+
+  if (reply)
+    dbus_message_unref (reply);
+  dbus_pending_call_unref (pending);
+}
+
+static void
+Accessibility_DeviceEventController_NotifyListenersAsync (const
+                                                          AtspiDeviceEvent
+                                                          * key_event)
+{
+  DBusMessage *message;
+  DBusPendingCall *pending = NULL;
+  PendingKey *key;
+
+  message = new_notify_listeners_message (key_event);
+  if (!message)
+    return;
+
+  SPI_PROBE3 (key_start, key_event->type, key_event->id, FALSE);
+  dbus_connection_send_with_reply (spi_global_app_data->bus, message,
+                                   &pending, 9000);
+  dbus_message_unref (message);
+  if (!pending)
+    return;
+
+  key = g_new (PendingKey, 1);
+  key->start = g_get_monotonic_time ();
+  key->id = key_event->id;
+  dbus_pending_call_set_notify (pending, notify_listeners_reply, key,
+                                g_free);
+}
+
 static void
 spi_init_keystroke_from_atk_key_event (AtspiDeviceEvent * keystroke,
                                        AtkKeyEventStruct * event)
@@ -223,8 +418,25 @@ spi_atk_bridge_key_listener (AtkKeyEventStruct * event, gpointer data)
 
   spi_init_keystroke_from_atk_key_event (&key_event, event);
 
-  result =
-    Accessibility_DeviceEventController_NotifyListenersSync (&key_event);
+  switch (spi_keystroke_listeners_match (&key_event))
+    {
+    case SPI_KEYSTROKE_MATCH_NONE:
+      /* No listener could want this key, so don't bother the registry */
+      result = FALSE;
+      break;
+    case SPI_KEYSTROKE_MATCH_NOTIFY:
+      if (async_keys_enabled ())
+        {
+          Accessibility_DeviceEventController_NotifyListenersAsync (&key_event);
+          result = FALSE;
+          break;
+        }
+      /* fall through */
+    default:
+      result =
+        Accessibility_DeviceEventController_NotifyListenersSync (&key_event);
+      break;
+    }
 
   if (key_event.event_string)
     g_free (key_event.event_string);
@@ -301,6 +513,92 @@ append_object (DBusMessageIter *iter,
   spi_object_append_v_reference (iter, ATK_OBJECT (val));
 }
 
+/*
+ * Text inserted, removed or changed is sent with the event, cut to at most
+ * AT_SPI_TEXT_PAYLOAD_MAX characters (16384 unless set, 0 meaning no
+ * limit). The event details still carry the full offset and length, so a
+ * client can fetch the rest through the Text interface if it needs it.
+ *
+ * The text for text-changed is only fetched from the accessible once the
+ * event is known to be wanted, as append_text is only called then.
+ */
+#define TEXT_PAYLOAD_MAX 16384
+
+typedef struct _TextPayload
+{
+  AtkObject *accessible;
+  const gchar *text;
+  gint start;
+  gint length;
+} TextPayload;
+
+static gint
+text_payload_max (void)
+{
+  static gint max = -1;
+
+  if (max < 0)
+    {
+      const gchar *envvar = g_getenv ("AT_SPI_TEXT_PAYLOAD_MAX");
+
+      max = envvar ? MAX (atoi (envvar), 0) : TEXT_PAYLOAD_MAX;
+    }
+  return max;
+}
+
+/* Byte length of at most max_chars characters, never reading past the end */
+static gsize
+text_prefix_len (const gchar *text, gint max_chars)
+{
+  const gchar *p = text;
+
+  while (*p && max_chars-- > 0)
+    {
+      gint skip = g_utf8_skip[*(const guchar *) p];
+      gint i;
+
+      for (i = 1; i < skip && p[i]; i++)
+        ;
+      p += i;
+    }
+  return p - text;
+}
+
+static void
+append_text (DBusMessageIter *iter,
+             const char *type,
+             const void *val)
+{
+  const TextPayload *payload = (const TextPayload *) val;
+  gint max = text_payload_max ();
+  gchar *fetched = NULL, *truncated = NULL;
+  const gchar *text = payload->text;
+
+  if (!text && payload->accessible)
+    {
+      gint length = payload->length;
+
+      if (max && length > max)
+        length = max;
+      text = fetched = atk_text_get_text (ATK_TEXT (payload->accessible),
+                                          payload->start,
+                                          payload->start + length);
+    }
+
+  if (text && max)
+    {
+      gsize len = text_prefix_len (text, max);
+
+      if (text[len])
+        text = truncated = g_strndup (text, len);
+    }
+
+  append_basic (iter, type, text);
+
+  g_free (truncated);
+  g_free (fetched);
+}
+
 static gchar *
 signal_name_to_dbus (const gchar *s)
 {
@@ -353,92 +651,873 @@ ensure_proper_format (const char *name)
   return ret;
 }
 
-void
-append_properties (GArray *properties, event_data *evdata)
+/*
+ * Event subscriptions are compiled into a trie keyed by the quarks of
+ * the class, major and minor names, so deciding whether an event is
+ * wanted doesn't depend on how many listeners are registered. A node
+ * records how many subscriptions end at it, and the properties they want
+ * attached. The trie is rebuilt from spi_global_app_data->events the
+ * first time it is needed after the subscriptions change.
+ */
+typedef struct _SpiEventNode SpiEventNode;
+
+struct _SpiEventNode
+{
+  GHashTable *children;
+  guint n_subscriptions;
+  GPtrArray *properties;
+};
+
+static SpiEventNode *event_trie = NULL;
+static gboolean event_trie_dirty = TRUE;
+
+/* Caches mapping the quark of an emitted name to its formatted quark */
+static GHashTable *formatted_names = NULL;
+static GHashTable *formatted_minors = NULL;
+
+static SpiEventNode *
+event_node_new (void)
+{
+  return g_slice_new0 (SpiEventNode);
+}
+
+static void
+event_node_free (SpiEventNode *node)
+{
+  if (node->children)
+    g_hash_table_destroy (node->children);
+  if (node->properties)
+    g_ptr_array_free (node->properties, TRUE);
+  g_slice_free (SpiEventNode, node);
+}
+
+static void
+event_node_add_properties (SpiEventNode *node, GSList *properties)
 {
   GSList *ls;
   gint i;
 
-  for (ls = evdata->properties; ls; ls = ls->next)
+  for (ls = properties; ls; ls = ls->next)
   {
     gboolean dup = FALSE;
-    for (i = 0; i < properties->len; i++)
+
+    if (!node->properties)
+      node->properties = g_ptr_array_new ();
+    for (i = 0; i < node->properties->len; i++)
     {
-      if (ls->data == g_array_index (properties, AtspiPropertyDefinition *, i))
+      if (ls->data == g_ptr_array_index (node->properties, i))
       {
         dup = TRUE;
         break;
       }
     }
     if (!dup)
-      g_array_append_val (properties, ls->data);
+      g_ptr_array_add (node->properties, ls->data);
   }
 }
 
+static void
+event_trie_add (SpiEventNode *root, event_data *evdata)
+{
+  SpiEventNode *node = root;
+  gchar **name;
+
+  for (name = evdata->data; *name && **name; name++)
+    {
+      GQuark quark = g_quark_from_string (*name);
+      SpiEventNode *child = NULL;
+
+      if (!node->children)
+        node->children = g_hash_table_new_full (g_direct_hash,
+                                                g_direct_equal, NULL,
+                                                (GDestroyNotify) event_node_free);
+      else
+        child = g_hash_table_lookup (node->children, GUINT_TO_POINTER (quark));
+
+      if (!child)
+        {
+          child = event_node_new ();
+          g_hash_table_insert (node->children, GUINT_TO_POINTER (quark), child);
+        }
+      node = child;
+    }
+
+  node->n_subscriptions++;
+  event_node_add_properties (node, evdata->properties);
+}
+
+static void
+event_trie_rebuild (void)
+{
+  GList *list;
+
+  if (event_trie)
+    event_node_free (event_trie);
+  event_trie = event_node_new ();
+
+  for (list = spi_global_app_data->events; list; list = list->next)
+    event_trie_add (event_trie, list->data);
+
+  event_trie_dirty = FALSE;
+}
+
+/*
+ * Called by the bridge whenever an event subscription, or the properties
+ * wanted with it, have changed.
+ */
+void
+spi_atk_event_subscriptions_changed (void)
+{
+  event_trie_dirty = TRUE;
+}
+
+/*
+ * Returns the quark for the formatted form of name, formatting it only
+ * the first time it is seen. Minor names are cut at the first ':', to
+ * cope with events such as "object::text-changed::insert:system" as
+ * generated by Gecko.
+ */
+static GQuark
+format_name (GHashTable **cache, const gchar *name, gboolean is_minor)
+{
+  GQuark quark, formatted;
+  gchar *str;
+
+  if (!*cache)
+    *cache = g_hash_table_new (g_direct_hash, g_direct_equal);
+
+  quark = g_quark_try_string (name);
+  if (quark)
+    {
+      formatted = GPOINTER_TO_UINT (g_hash_table_lookup (*cache,
+                                                         GUINT_TO_POINTER (quark)));
+      if (formatted)
+        return formatted;
+    }
+  else
+    quark = g_quark_from_string (name);
+
+  str = ensure_proper_format (name);
+  if (is_minor)
+    str [strcspn (str, ":")] = '\0';
+  formatted = g_quark_from_string (str);
+  g_free (str);
+
+  g_hash_table_insert (*cache, GUINT_TO_POINTER (quark),
+                       GUINT_TO_POINTER (formatted));
+  return formatted;
+}
+
+static void
+append_node_properties (GArray **properties, SpiEventNode *node)
+{
+  gint i, j;
+
+  if (!node->properties)
+    return;
+
+  if (!*properties)
+    *properties = g_array_new (TRUE, TRUE, sizeof (AtspiPropertyDefinition *));
+
+  for (i = 0; i < node->properties->len; i++)
+  {
+    gpointer prop = g_ptr_array_index (node->properties, i);
+    gboolean dup = FALSE;
+
+    for (j = 0; j < (*properties)->len; j++)
+    {
+      if (prop == g_array_index (*properties, AtspiPropertyDefinition *, j))
+      {
+        dup = TRUE;
+        break;
+      }
+    }
+    if (!dup)
+      g_array_append_val (*properties, prop);
+  }
+}
+
+/*
+ * Looks up the quarks of the formatted class, major and minor names,
+ * which the subscription trie and the event statistics are keyed by.
+ */
+static void
+event_names_to_quarks (const gchar *klass, const gchar *major,
+                       const gchar *minor, GQuark *names)
+{
+  /* Skip the "org.a11y.atspi.Event." prefix shared by the classes */
+  names [0] = format_name (&formatted_names,
+                           strlen (klass) > 21 ? klass + 21 : klass, FALSE);
+  names [1] = format_name (&formatted_names, major, FALSE);
+  names [2] = format_name (&formatted_minors, minor, TRUE);
+}
+
 static gboolean
-signal_is_needed (AtkObject *obj, const gchar *klass, const gchar *major,
-                  const gchar *minor, GArray **properties)
+signal_is_needed (AtkObject *obj, const GQuark *path, const gchar *minor,
+                  GArray **properties)
 {
-  gchar *data [4];
-  event_data *evdata;
+  static GQuark quark_children_changed = 0;
+  static GQuark quark_state_changed = 0;
+  SpiEventNode *node;
   gboolean ret = FALSE;
-  GList *list;
   GArray *props = NULL;
+  gint i;
 
   if (!spi_global_app_data->events_initialized)
     return TRUE;
 
-  data [0] = ensure_proper_format (klass + 21);
-  data [1] = ensure_proper_format (major);
-  data [2] = ensure_proper_format (minor);
-  data [3] = NULL;
+  if (!quark_children_changed)
+    {
+      quark_children_changed = g_quark_from_static_string ("ChildrenChanged");
+      quark_state_changed = g_quark_from_static_string ("StateChanged");
+    }
 
   /* Hack: Always pass events that update the cache.
    * TODO: FOr 2.2, have at-spi2-core define a special "cache listener" for
    * this instead, so that we don't send these if no one is listening */
-  if (!g_strcmp0 (data [1], "ChildrenChanged") ||
-      ((!g_strcmp0 (data [1], "PropertyChange")) &&
-       (!g_strcmp0 (data [2], "accessible-name") ||
-        !g_strcmp0 (data [2], "accessible-description") ||
-        !g_strcmp0 (data [2], "accessible-parent") ||
-        !g_strcmp0 (data [2], "accessible-role"))) ||
-      !g_strcmp0 (data [1], "StateChanged"))
+  if (path [1] == quark_children_changed || path [1] == quark_state_changed)
   {
     if (minor && !g_strcmp0 (minor, "defunct"))
       ret = TRUE;
     else
     {
       AtkStateSet *set = atk_object_ref_state_set (obj);
-      AtkState state = ((!g_strcmp0 (data[1], "ChildrenChanged")) ?
+      AtkState state = ((path [1] == quark_children_changed) ?
                         ATK_STATE_MANAGES_DESCENDANTS : ATK_STATE_TRANSIENT);
       ret = !atk_state_set_contains_state (set, state);
       g_object_unref (set);
     }
   }
 
-  /* Hack: events such as "object::text-changed::insert:system" as
-     generated by Gecko */
-  data [2][strcspn (data [2], ":")] = '\0';
+  if (event_trie_dirty)
+    event_trie_rebuild ();
 
-  for (list = spi_global_app_data->events; list; list = list->next)
+  node = event_trie;
+  for (i = 0; node; i++)
     {
-      evdata = list->data;
-      if (spi_event_is_subtype (data, evdata->data))
+      if (node->n_subscriptions)
         {
           ret = TRUE;
-          if (!props)
-          props = g_array_new (TRUE, TRUE, sizeof (AtspiPropertyDefinition *));
-          append_properties (props, evdata);
+          append_node_properties (&props, node);
         }
+
+      if (i == 3 || !node->children)
+        break;
+      node = g_hash_table_lookup (node->children, GUINT_TO_POINTER (path [i]));
     }
 
-  g_free (data [2]);
-  g_free (data [1]);
-  g_free (data [0]);
   *properties = props;
   return ret;
 }
 
+/*
+ * Event coalescing, enabled by setting AT_SPI_EVENT_COALESCE_MS.
+ *
+ * Bounds, visible data, caret and property changes come in storms while
+ * animating, scrolling or typing. When coalescing, such an event is held
+ * back instead of being sent, replacing any held back event of the same
+ * kind and minor for the same object, so only the latest one is sent.
+ * Held back events are sent in the order they last occurred, when the
+ * main loop next goes idle or, if AT_SPI_EVENT_COALESCE_MS is above 0,
+ * that many milliseconds after the first one was held. Any other event
+ * sends the held back ones first, so the order between different kinds
+ * of events is kept.
+ */
+typedef struct _CoalescedEvent
+{
+  gchar *key;
+  DBusMessage *sig;
+  GList link;
+} CoalescedEvent;
+
+static void
+schedule_signal (DBusConnection *bus, DBusMessage *sig);
+
+static gint coalesce_ms = -2;
+static GHashTable *coalesced_events = NULL;
+static GQueue coalesced_queue = G_QUEUE_INIT;
+static guint coalesce_source = 0;
+
+static gboolean
+coalescing_enabled (void)
+{
+  if (coalesce_ms == -2)
+    {
+      const gchar *envvar = g_getenv ("AT_SPI_EVENT_COALESCE_MS");
+
+      coalesce_ms = envvar ? MAX (atoi (envvar), 0) : -1;
+    }
+  return coalesce_ms >= 0;
+}
+
+static gboolean
+event_is_coalescible (const char *klass, const char *major)
+{
+  if (strcmp (klass, ITF_EVENT_OBJECT) != 0)
+    return FALSE;
+
+  return (!strcmp (major, "bounds-changed") ||
+          !strcmp (major, "visible-data-changed") ||
+          !strcmp (major, "text-caret-moved") ||
+          !strcmp (major, PCHANGE));
+}
+
+static void
+coalesced_event_free (CoalescedEvent *event)
+{
+  if (event->sig)
+    dbus_message_unref (event->sig);
+  g_free (event->key);
+  g_slice_free (CoalescedEvent, event);
+}
+
+static void
+flush_coalesced_events (void)
+{
+  GList *link;
+
+  if (coalesce_source)
+    {
+      g_source_remove (coalesce_source);
+      coalesce_source = 0;
+    }
+
+  while ((link = g_queue_pop_head_link (&coalesced_queue)))
+    {
+      CoalescedEvent *event = link->data;
+
+      if (spi_global_app_data->bus)
+        schedule_signal (spi_global_app_data->bus, event->sig);
+      g_hash_table_remove (coalesced_events, event->key);
+    }
+}
+
+/*
+ * Event batching, for clients that called EventBatch.Enable on the
+ * bridge's own path.
+ *
+ * Signals sent while the main loop is busy are collected and sent together
+ * as EventBatch signals once it goes idle, or as soon as EVENT_BATCH_MAX
+ * of them are waiting, each entry holding the path, interface and name of
+ * a signal followed by its arguments. Signals are broadcast, so events are
+ * only batched once every known client has opted in; until then they are
+ * all sent individually and no client gets an event twice.
+ */
+#define EVENT_BATCH_MAX 256
+
+static GQueue batched_events = G_QUEUE_INIT;
+static guint batch_idle = 0;
+
+/* Copies the remaining arguments from one message iterator to another */
+static void
+copy_args (DBusMessageIter *from, DBusMessageIter *to)
+{
+  int type;
+
+  for (; (type = dbus_message_iter_get_arg_type (from)) != DBUS_TYPE_INVALID;
+       dbus_message_iter_next (from))
+    {
+      DBusMessageIter from_sub, to_sub;
+      char *sig = NULL;
+
+      if (dbus_type_is_basic (type))
+        {
+          DBusBasicValue value;
+
+          dbus_message_iter_get_basic (from, &value);
+          dbus_message_iter_append_basic (to, type, &value);
+          continue;
+        }
+
+      if (type == DBUS_TYPE_VARIANT)
+        {
+          dbus_message_iter_recurse (from, &from_sub);
+          sig = dbus_message_iter_get_signature (&from_sub);
+        }
+      else if (type == DBUS_TYPE_ARRAY)
+        sig = dbus_message_iter_get_signature (from);
+
+      dbus_message_iter_recurse (from, &from_sub);
+      dbus_message_iter_open_container (to, type,
+                                        (sig && type == DBUS_TYPE_ARRAY) ?
+                                        sig + 1 : sig, &to_sub);
+      copy_args (&from_sub, &to_sub);
+      dbus_message_iter_close_container (to, &to_sub);
+      dbus_free (sig);
+    }
+}
+
+static void
+flush_event_batch (void)
+{
+  DBusConnection *bus = spi_global_app_data->bus;
+
+  if (batch_idle)
+    {
+      g_source_remove (batch_idle);
+      batch_idle = 0;
+    }
+
+  while (batched_events.length)
+    {
+      DBusMessage *batch;
+      DBusMessageIter iter, iter_array;
+      guint n;
+
+      batch = dbus_message_new_signal (SPI_DBUS_PATH_BRIDGE,
+                                       SPI_DBUS_INTERFACE_EVENT_BATCH,
+                                       "EventBatch");
+      dbus_message_iter_init_append (batch, &iter);
+      dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY,
+                                        SPI_EVENT_BATCH_ENTRY_SIGNATURE,
+                                        &iter_array);
+      for (n = 0; n < EVENT_BATCH_MAX && batched_events.length; n++)
+        {
+          DBusMessage *sig = g_queue_pop_head (&batched_events);
+          DBusMessageIter iter_entry, iter_args;
+          const char *path = dbus_message_get_path (sig);
+          const char *itf = dbus_message_get_interface (sig);
+          const char *member = dbus_message_get_member (sig);
+
+          dbus_message_iter_open_container (&iter_array, DBUS_TYPE_STRUCT,
+                                            NULL, &iter_entry);
+          dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_OBJECT_PATH,
+                                          &path);
+          dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_STRING, &itf);
+          dbus_message_iter_append_basic (&iter_entry, DBUS_TYPE_STRING,
+                                          &member);
+          dbus_message_iter_init (sig, &iter_args);
+          copy_args (&iter_args, &iter_entry);
+          dbus_message_iter_close_container (&iter_array, &iter_entry);
+          dbus_message_unref (sig);
+        }
+      dbus_message_iter_close_container (&iter, &iter_array);
+
+      if (bus)
+        spi_dbus_send (bus, batch);
+      dbus_message_unref (batch);
+    }
+}
+
+static gboolean
+batch_idle_func (gpointer data)
+{
+  batch_idle = 0;
+  flush_event_batch ();
+  return FALSE;
+}
+
+/* Whether a signal is an event, rather than eg. a cache signal */
+static gboolean
+signal_is_event (DBusMessage *sig)
+{
+  return g_str_has_prefix (dbus_message_get_interface (sig),
+                           "org.a11y.atspi.Event.");
+}
+
+/* Sends an event signal, or adds it to the next batch */
+static void
+post_signal (DBusConnection *bus, DBusMessage *sig)
+{
+  if (signal_is_event (sig) &&
+      spi_atk_n_clients_with_flag (SPI_CLIENT_EVENT_BATCH) &&
+      spi_atk_all_clients_have_flag (SPI_CLIENT_EVENT_BATCH))
+    {
+      g_queue_push_tail (&batched_events, dbus_message_ref (sig));
+      if (batched_events.length >= EVENT_BATCH_MAX)
+        flush_event_batch ();
+      else if (!batch_idle)
+        batch_idle = g_idle_add (batch_idle_func, NULL);
+      return;
+    }
+
+  /* Anything not batched goes out behind the current batch */
+  if (batched_events.length)
+    flush_event_batch ();
+  spi_dbus_send (bus, sig);
+}
+
+/*
+ * Event scheduling.
+ *
+ * A flood of structural or bounds events can fill the connection's
+ * outgoing queue, and a focus or caret event raised behind it only reaches
+ * the screen reader once all of it has been written. So once more than
+ * SCHEDULE_QUEUE_BYTES are waiting to be written, further events are held
+ * back in our own queue and fed to the connection as it drains. Urgent
+ * events (focus, active descendant, caret, focused state and window
+ * activation) skip that queue, which also keeps key event calls to the
+ * registry from waiting behind the flood.
+ *
+ * Events for one object always go out in the order they were raised: an
+ * urgent event first sends any held back events for the same object.
+ *
+ * If a listener stalls, the held back events are degraded so that they
+ * can't use up the application's memory. Past AT_SPI_EVENT_QUEUE_LOW held
+ * back events (1000 by default), a bounds, visible data or property change
+ * event supersedes a held back one of the same kind for the same object,
+ * which is dropped while the new one is queued behind the object's other
+ * events. Past AT_SPI_EVENT_QUEUE_HIGH (10000 by default) such events are dropped,
+ * and past twice that all but urgent events are. Once the queue is back
+ * under the low mark, an EventQueue.EventsDropped signal tells clients
+ * how many events they missed, so that they can refresh what they know.
+ *
+ * Cache signals go through the same queue (spi_atk_schedule_signal), so
+ * that a client isn't told an object was removed before the events raised
+ * for it ahead of the removal. They are never degraded or dropped, as a
+ * client's cache would go wrong without them, and nor is EventsDropped,
+ * which is sent straight to the connection. Those that go out while the
+ * queue is past the low mark are counted as exempt. Replies and the
+ * spi_dbus_emit_* helpers, which no event uses, bypass the queue entirely.
+ */
+#define SCHEDULE_QUEUE_BYTES (32 * 1024)
+#define SCHEDULE_RETRY_MS 10
+#define SCHEDULE_QUEUE_LOW 1000
+#define SCHEDULE_QUEUE_HIGH 10000
+#define SCHEDULE_REPLACE_SCAN 64
+
+typedef struct _ScheduledEvent
+{
+  DBusMessage *sig;
+  GQueue *object_queue;
+  GList link;
+  GList object_link;
+} ScheduledEvent;
+
+static GQueue scheduled_events = G_QUEUE_INIT;
+static GHashTable *scheduled_objects = NULL;
+static guint schedule_source = 0;
+
+static guint queue_low = 0;
+static guint queue_high = 0;
+static guint n_unreported_drops = 0;
+static SpiEventQueueStats queue_stats;
+
+static void
+init_queue_marks (void)
+{
+  const gchar *envvar;
+
+  if (queue_high)
+    return;
+
+  envvar = g_getenv ("AT_SPI_EVENT_QUEUE_LOW");
+  queue_low = envvar ? MAX (atoi (envvar), 1) : SCHEDULE_QUEUE_LOW;
+  envvar = g_getenv ("AT_SPI_EVENT_QUEUE_HIGH");
+  queue_high = envvar ? MAX (atoi (envvar), 1) : SCHEDULE_QUEUE_HIGH;
+  queue_high = MAX (queue_high, queue_low);
+}
+
+void
+spi_atk_get_event_queue_stats (SpiEventQueueStats *stats)
+{
+  *stats = queue_stats;
+  stats->n_held = scheduled_events.length;
+}
+
+static gboolean
+event_is_urgent (DBusMessage *sig)
+{
+  const char *itf = dbus_message_get_interface (sig);
+  const char *member = dbus_message_get_member (sig);
+
+  if (!strcmp (itf, ITF_EVENT_FOCUS))
+    return TRUE;
+
+  if (!strcmp (itf, ITF_EVENT_WINDOW))
+    return (!strcmp (member, "Activate") || !strcmp (member, "Deactivate"));
+
+  if (strcmp (itf, ITF_EVENT_OBJECT) != 0)
+    return FALSE;
+
+  if (!strcmp (member, "ActiveDescendantChanged") ||
+      !strcmp (member, "TextCaretMoved"))
+    return TRUE;
+
+  if (!strcmp (member, "StateChanged"))
+    {
+      DBusMessageIter iter;
+      const char *minor = "";
+
+      dbus_message_iter_init (sig, &iter);
+      if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_STRING)
+        dbus_message_iter_get_basic (&iter, &minor);
+      return !strcmp (minor, "focused");
+    }
+
+  return FALSE;
+}
+
+/* Events that only matter for their latest value */
+static gboolean
+event_is_degradable (DBusMessage *sig)
+{
+  const char *member = dbus_message_get_member (sig);
+
+  if (strcmp (dbus_message_get_interface (sig), ITF_EVENT_OBJECT) != 0)
+    return FALSE;
+
+  return (!strcmp (member, "BoundsChanged") ||
+          !strcmp (member, "VisibleDataChanged") ||
+          !strcmp (member, PCHANGE));
+}
+
+static const char *
+get_event_minor (DBusMessage *sig)
+{
+  DBusMessageIter iter;
+  const char *minor = "";
+
+  dbus_message_iter_init (sig, &iter);
+  if (dbus_message_iter_get_arg_type (&iter) == DBUS_TYPE_STRING)
+    dbus_message_iter_get_basic (&iter, &minor);
+  return minor;
+}
+
+/*
+ * Drops a held back event of the same kind and minor as sig from among
+ * the last ones in an object's queue, so that sig can be queued in its
+ * stead. sig goes at the tail, after any other events for the object
+ * that the dropped one preceded. Returns FALSE if there was none.
+ */
+static gboolean
+drop_superseded_event (GQueue *object_queue, DBusMessage *sig)
+{
+  const char *member = dbus_message_get_member (sig);
+  const char *minor = get_event_minor (sig);
+  GList *l;
+  guint n = 0;
+
+  for (l = object_queue->tail; l && n < SCHEDULE_REPLACE_SCAN; l = l->prev, n++)
+    {
+      ScheduledEvent *event = l->data;
+
+      if (!strcmp (dbus_message_get_member (event->sig), member) &&
+          !strcmp (get_event_minor (event->sig), minor))
+        {
+          g_queue_unlink (&scheduled_events, &event->link);
+          g_queue_unlink (object_queue, &event->object_link);
+          dbus_message_unref (event->sig);
+          g_slice_free (ScheduledEvent, event);
+          return TRUE;
+        }
+    }
+  return FALSE;
+}
+
+static void
+report_dropped_events (DBusConnection *bus)
+{
+  DBusMessage *sig;
+  dbus_uint32_t count = n_unreported_drops;
+
+  n_unreported_drops = 0;
+  sig = dbus_message_new_signal (SPI_DBUS_PATH_BRIDGE,
+                                 SPI_DBUS_INTERFACE_EVENT_QUEUE,
+                                 "EventsDropped");
+  if (!sig)
+    return;
+  queue_stats.n_exempt++;
+  dbus_message_append_args (sig, DBUS_TYPE_UINT32, &count, DBUS_TYPE_INVALID);
+  spi_dbus_send (bus, sig);
+  dbus_message_unref (sig);
+}
+
+/* Removes an event from both queues and sends it */
+static void
+post_scheduled_event (DBusConnection *bus, ScheduledEvent *event)
+{
+  GQueue *object_queue = event->object_queue;
+
+  g_queue_unlink (&scheduled_events, &event->link);
+  g_queue_unlink (object_queue, &event->object_link);
+  if (!object_queue->length)
+    g_hash_table_remove (scheduled_objects, dbus_message_get_path (event->sig));
+
+  if (bus)
+    post_signal (bus, event->sig);
+  dbus_message_unref (event->sig);
+  g_slice_free (ScheduledEvent, event);
+}
+
+static gboolean
+schedule_timeout (gpointer data);
+
+static void
+run_scheduled_events (void)
+{
+  DBusConnection *bus = spi_global_app_data->bus;
+
+  while (scheduled_events.length &&
+         (!bus || dbus_connection_get_outgoing_size (bus) < SCHEDULE_QUEUE_BYTES))
+    post_scheduled_event (bus, g_queue_peek_head (&scheduled_events));
+
+  if (n_unreported_drops && bus && scheduled_events.length < queue_low)
+    report_dropped_events (bus);
+
+  if (scheduled_events.length && !schedule_source)
+    schedule_source = g_timeout_add (SCHEDULE_RETRY_MS, schedule_timeout, NULL);
+}
+
+static gboolean
+schedule_timeout (gpointer data)
+{
+  schedule_source = 0;
+  run_scheduled_events ();
+  return FALSE;
+}
+
+/* Sends all held back events without waiting for the connection */
+static void
+flush_scheduled_events (void)
+{
+  DBusConnection *bus = spi_global_app_data->bus;
+  ScheduledEvent *event;
+
+  if (schedule_source)
+    {
+      g_source_remove (schedule_source);
+      schedule_source = 0;
+    }
+
+  while ((event = g_queue_peek_head (&scheduled_events)))
+    post_scheduled_event (bus, event);
+
+  if (n_unreported_drops && bus)
+    report_dropped_events (bus);
+  n_unreported_drops = 0;
+}
+
+static void
+schedule_signal (DBusConnection *bus, DBusMessage *sig)
+{
+  const char *path = dbus_message_get_path (sig);
+  ScheduledEvent *event;
+  GQueue *object_queue;
+  guint held = scheduled_events.length;
+
+  if (event_is_urgent (sig))
+    {
+      /* Keep this object's events in order; the last one frees its queue */
+      while (scheduled_objects &&
+             (object_queue = g_hash_table_lookup (scheduled_objects, path)))
+        post_scheduled_event (bus, g_queue_peek_head (object_queue));
+      post_signal (bus, sig);
+      return;
+    }
+
+  if (!scheduled_events.length &&
+      dbus_connection_get_outgoing_size (bus) < SCHEDULE_QUEUE_BYTES)
+    {
+      post_signal (bus, sig);
+      return;
+    }
+
+  if (!scheduled_objects)
+    scheduled_objects = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                               g_free,
+                                               (GDestroyNotify) g_queue_free);
+  object_queue = g_hash_table_lookup (scheduled_objects, path);
+
+  init_queue_marks ();
+  if (held >= queue_low && !signal_is_event (sig))
+    queue_stats.n_exempt++;
+  else if (held >= queue_low)
+    {
+      gboolean degradable = event_is_degradable (sig);
+
+      if ((degradable && held >= queue_high) || held >= 2 * queue_high)
+        {
+          queue_stats.n_dropped++;
+          n_unreported_drops++;
+          return;
+        }
+      if (degradable && object_queue &&
+          drop_superseded_event (object_queue, sig))
+        queue_stats.n_coalesced++;
+    }
+
+  if (!object_queue)
+    {
+      object_queue = g_queue_new ();
+      g_hash_table_insert (scheduled_objects, g_strdup (path), object_queue);
+    }
+
+  event = g_slice_new (ScheduledEvent);
+  event->sig = dbus_message_ref (sig);
+  event->object_queue = object_queue;
+  event->link.data = event;
+  event->object_link.data = event;
+  g_queue_push_tail_link (&scheduled_events, &event->link);
+  g_queue_push_tail_link (object_queue, &event->object_link);
+
+  run_scheduled_events ();
+}
+
+/*
+ * Sends a signal other than an event, such as a cache signal, in order
+ * with the events raised before it.
+ */
+void
+spi_atk_schedule_signal (DBusConnection *bus, DBusMessage *sig)
+{
+  schedule_signal (bus, sig);
+}
+
+static gboolean
+coalesce_timeout (gpointer data)
+{
+  coalesce_source = 0;
+  flush_coalesced_events ();
+  return FALSE;
+}
+
+static void
+send_event (DBusConnection *bus, DBusMessage *sig, const char *path,
+            const char *klass, const char *major, const char *minor)
+{
+  CoalescedEvent *event;
+  gchar *key;
+
+  if (!coalescing_enabled () || !event_is_coalescible (klass, major))
+    {
+      if (coalesced_queue.length)
+        flush_coalesced_events ();
+      schedule_signal (bus, sig);
+      return;
+    }
+
+  if (!coalesced_events)
+    coalesced_events = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                              (GDestroyNotify) coalesced_event_free);
+
+  key = g_strconcat (path, "\n", major, "\n", minor, NULL);
+  event = g_hash_table_lookup (coalesced_events, key);
+  if (event)
+    {
+      g_free (key);
+      dbus_message_unref (event->sig);
+      g_queue_unlink (&coalesced_queue, &event->link);
+    }
+  else
+    {
+      event = g_slice_new (CoalescedEvent);
+      event->key = key;
+      event->link.data = event;
+      g_hash_table_insert (coalesced_events, key, event);
+    }
+  event->sig = dbus_message_ref (sig);
+  g_queue_push_tail_link (&coalesced_queue, &event->link);
+
+  if (!coalesce_source)
+    {
+      if (coalesce_ms > 0)
+        coalesce_source = g_timeout_add (coalesce_ms, coalesce_timeout, NULL);
+      else
+        coalesce_source = g_idle_add (coalesce_timeout, NULL);
+    }
+}
+
 /* Convert a : to a / so that listeners can use arg0path to match only
  *  * the prefix */
 static char *
@@ -481,24 +1560,47 @@ emit_event (AtkObject  *obj,
             void (*append_variant) (DBusMessageIter *, const char *, const void *))
 {
   DBusConnection *bus = spi_global_app_data->bus;
-  char *path;
+  const char *path;
   char *minor_dbus;
 
   gchar *cname;
   DBusMessage *sig;
   DBusMessageIter iter, iter_dict, iter_dict_entry, iter_variant, iter_array;
   GArray *properties = NULL;
+  SpiEventStats *stats;
+  GQuark names [3];
+  gboolean needed;
+  gint64 trace_start = spi_trace_begin ();
   
   if (!klass) klass = "";
   if (!major) major = "";
   if (!minor) minor = "";
   if (!type) type = "u";
 
-  if (!signal_is_needed (obj, klass, major, minor, &properties))
-    return;
+  event_names_to_quarks (klass, major, minor, names);
+  stats = get_event_stats (names, klass, major);
+  stats->received++;
 
-  path =  spi_register_object_to_path (spi_global_register, G_OBJECT (obj));
-  g_return_if_fail (path != NULL);
+  needed = signal_is_needed (obj, names, minor, &properties);
+  SPI_PROBE4 (event_decided, klass, major, minor, needed);
+  if (!needed)
+    {
+      spi_trace_end ("emit_event", klass, g_intern_string (major),
+                     trace_start);
+      return;
+    }
+
+  path =  spi_register_object_get_path (spi_global_register, G_OBJECT (obj));
+  if (!path)
+    {
+      if (properties)
+        g_array_free (properties, TRUE);
+      spi_trace_end ("emit_event", klass, g_intern_string (major),
+                     trace_start);
+      g_critical ("atk-bridge: No path for an object raising %s:%s",
+                  klass, major);
+      return;
+    }
 
   /*
    * This is very annoying, but as '-' isn't a legal signal
@@ -539,14 +1641,16 @@ emit_event (AtkObject  *obj,
   }
     dbus_message_iter_close_container (&iter, &iter_dict);
 
-  dbus_connection_send(bus, sig, NULL);
+  send_event (bus, sig, path, klass, major, minor);
   dbus_message_unref(sig);
+  stats->emitted++;
+  SPI_PROBE4 (event_emitted, klass, major, minor, path);
 
   if (g_strcmp0 (cname, "ChildrenChanged") != 0)
     spi_object_lease_if_needed (G_OBJECT (obj));
 
   g_free(cname);
-  g_free (path);
+  spi_trace_end ("emit_event", klass, g_intern_string (major), trace_start);
 }
 
 /*---------------------------------------------------------------------------*/
@@ -564,8 +1668,6 @@ focus_tracker (AtkObject * accessible)
 
 /*---------------------------------------------------------------------------*/
 
-#define PCHANGE "PropertyChange"
-
 /* 
  * This handler handles the following ATK signals and
  * converts them to AT-SPI events:
@@ -593,6 +1695,17 @@ property_event_listener (GSignalInvocationHint * signal_hint,
 
   pname = values[0].property_name;
 
+  if (strcmp (pname, "accessible-name") == 0 ||
+      strcmp (pname, "accessible-description") == 0 ||
+      strcmp (pname, "accessible-role") == 0)
+    spi_cache_item_invalidate (accessible);
+  else if (strcmp (pname, "accessible-parent") == 0)
+    {
+      spi_cache_item_invalidate (accessible);
+      spi_cache_item_structure_changed ();
+      spi_cache_parent_changed (spi_global_cache, G_OBJECT (accessible));
+    }
+
   /* TODO Could improve this control statement by matching
    * on only the end of the signal names,
    */
@@ -715,6 +1828,8 @@ state_event_listener (GSignalInvocationHint * signal_hint,
   accessible = ATK_OBJECT (g_value_get_object (&param_values[0]));
   pname = g_value_get_string (&param_values[1]);
 
+  spi_cache_item_invalidate (accessible);
+
   detail1 = (g_value_get_boolean (&param_values[2])) ? 1 : 0;
   emit_event (accessible, ITF_EVENT_OBJECT, STATE_CHANGED, pname, detail1, 0,
               DBUS_TYPE_INT32_AS_STRING, 0, append_basic);
@@ -906,7 +2021,7 @@ text_changed_event_listener (GSignalInvocationHint * signal_hint,
   AtkObject *accessible;
   GSignalQuery signal_query;
   const gchar *name, *minor;
-  gchar *selected;
+  TextPayload payload;
   gint detail1 = 0, detail2 = 0;
 
   g_signal_query (signal_hint->signal_id, &signal_query);
@@ -921,12 +2036,13 @@ text_changed_event_listener (GSignalInvocationHint * signal_hint,
   if (G_VALUE_TYPE (&param_values[2]) == G_TYPE_INT)
     detail2 = g_value_get_int (&param_values[2]);
 
-  selected =
-    atk_text_get_text (ATK_TEXT (accessible), detail1, detail1 + detail2);
+  payload.accessible = accessible;
+  payload.text = NULL;
+  payload.start = detail1;
+  payload.length = detail2;
 
   emit_event (accessible, ITF_EVENT_OBJECT, name, minor, detail1, detail2,
-              DBUS_TYPE_STRING_AS_STRING, selected, append_basic);
-  g_free (selected);
+              DBUS_TYPE_STRING_AS_STRING, &payload, append_text);
 
   return TRUE;
 }
@@ -945,8 +2061,9 @@ text_insert_event_listener (GSignalInvocationHint * signal_hint,
   guint text_changed_signal_id;
   GSignalQuery signal_query;
   const gchar *name;
-  const gchar *minor_raw, *text;
+  const gchar *minor_raw;
   gchar *minor;
+  TextPayload payload = { NULL, NULL, 0, 0 };
   gint detail1 = 0, detail2 = 0;
 
   accessible = ATK_OBJECT (g_value_get_object (&param_values[0]));
@@ -972,10 +2089,10 @@ text_insert_event_listener (GSignalInvocationHint * signal_hint,
     detail2 = g_value_get_int (&param_values[2]);
 
   if (G_VALUE_TYPE (&param_values[3]) == G_TYPE_STRING)
-    text = g_value_get_string (&param_values[3]);
+    payload.text = g_value_get_string (&param_values[3]);
 
   emit_event (accessible, ITF_EVENT_OBJECT, name, minor, detail1, detail2,
-              DBUS_TYPE_STRING_AS_STRING, text, append_basic);
+              DBUS_TYPE_STRING_AS_STRING, &payload, append_text);
   g_free (minor);
   return TRUE;
 }
@@ -994,8 +2111,9 @@ text_remove_event_listener (GSignalInvocationHint * signal_hint,
   guint text_changed_signal_id;
   GSignalQuery signal_query;
   const gchar *name;
-  const gchar *minor_raw, *text;
+  const gchar *minor_raw;
   gchar *minor;
+  TextPayload payload = { NULL, NULL, 0, 0 };
   gint detail1 = 0, detail2 = 0;
 
   accessible = ATK_OBJECT (g_value_get_object (&param_values[0]));
@@ -1021,10 +2139,10 @@ text_remove_event_listener (GSignalInvocationHint * signal_hint,
     detail2 = g_value_get_int (&param_values[2]);
 
   if (G_VALUE_TYPE (&param_values[3]) == G_TYPE_STRING)
-    text = g_value_get_string (&param_values[3]);
+    payload.text = g_value_get_string (&param_values[3]);
 
   emit_event (accessible, ITF_EVENT_OBJECT, name, minor, detail1, detail2,
-              DBUS_TYPE_STRING_AS_STRING, text, append_basic);
+              DBUS_TYPE_STRING_AS_STRING, &payload, append_text);
   g_free (minor);
   return TRUE;
 }
@@ -1087,6 +2205,8 @@ children_changed_event_listener (GSignalInvocationHint * signal_hint,
   g_signal_query (signal_hint->signal_id, &signal_query);
   name = signal_query.signal_name;
 
+  spi_cache_item_structure_changed ();
+
   /* If the accessible is on STATE_MANAGES_DESCENDANTS state,
      children-changed signal are not forwarded. */
   accessible = ATK_OBJECT (g_value_get_object (&param_values[0]));
@@ -1211,6 +2331,8 @@ spi_atk_register_event_listeners (void)
   /* Register for focus event notifications, and register app with central registry  */
   listener_ids = g_array_sized_new (FALSE, TRUE, sizeof (guint), 16);
 
+  spi_cache_item_memo_enable (TRUE);
+
   atk_bridge_focus_tracker_id = atk_add_focus_tracker (focus_tracker);
 
   add_signal_listener (property_event_listener,
@@ -1321,6 +2443,23 @@ spi_atk_deregister_event_listeners (void)
   GArray *ids = listener_ids;
   listener_ids = NULL;
 
+  spi_cache_item_memo_enable (FALSE);
+
+  /*
+   * Send what is held back, which includes the events spi_atk_tidy_windows
+   * has just emitted, in the order the stages pass events on
+   */
+  flush_coalesced_events ();
+  flush_scheduled_events ();
+  flush_event_batch ();
+
+  if (event_trie)
+    {
+      event_node_free (event_trie);
+      event_trie = NULL;
+      event_trie_dirty = TRUE;
+    }
+
   if (atk_bridge_focus_tracker_id)
   {
     atk_remove_focus_tracker (atk_bridge_focus_tracker_id);
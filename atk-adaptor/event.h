@@ -25,9 +25,45 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#define SPI_KEY_LATENCY_BUCKETS 16
+
+typedef struct _SpiKeyLatencyStats SpiKeyLatencyStats;
+
+struct _SpiKeyLatencyStats
+{
+  guint64 sync[SPI_KEY_LATENCY_BUCKETS];
+  guint64 async[SPI_KEY_LATENCY_BUCKETS];
+  guint64 n_timeouts;
+};
+
+typedef struct _SpiEventQueueStats SpiEventQueueStats;
+
+struct _SpiEventQueueStats
+{
+  guint n_held;
+  guint64 n_coalesced;
+  guint64 n_dropped;
+  guint64 n_exempt;
+};
+
+typedef void (*SpiEventStatsFunc) (const gchar *klass, const gchar *major,
+                                   guint64 received, guint64 emitted,
+                                   gpointer user_data);
+
 void spi_atk_register_event_listeners (void);
 void spi_atk_deregister_event_listeners (void);
 void spi_atk_tidy_windows (void);
+void spi_atk_event_subscriptions_changed (void);
 
 gboolean spi_event_is_subtype (gchar **needle, gchar **haystack);
+
+void spi_atk_get_key_latency_stats (SpiKeyLatencyStats *stats);
+void spi_atk_foreach_event_stats (SpiEventStatsFunc func, gpointer user_data);
+void spi_atk_get_event_queue_stats (SpiEventQueueStats *stats);
+void spi_atk_schedule_signal (DBusConnection *bus, DBusMessage *sig);
+
+/* An entry of an EventBatch signal: path, interface and name of the
+   event's signal, then its arguments */
+#define SPI_EVENT_BATCH_ENTRY_SIGNATURE "(osssiiva{sv})"
+
 #endif /* EVENT_H */
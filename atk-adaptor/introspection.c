@@ -765,16 +765,45 @@ const char *spi_org_a11y_atspi_Cache =
 "    "
 "  </method>"
 ""
+"  <method name=\"GetItemsPaged\">"
+"    <arg direction=\"in\" name=\"cursor\" type=\"u\" />"
+"    <arg direction=\"in\" name=\"count\" type=\"u\" />"
+"    <arg direction=\"out\" name=\"nodes\" type=\"a((so)(so)iiassusau)\" />"
+"    <arg direction=\"out\" name=\"next\" type=\"u\" />"
+"    "
+"  </method>"
+""
+"  <method name=\"GetProperties\">"
+"    <arg direction=\"in\" name=\"paths\" type=\"ao\" />"
+"    <arg direction=\"in\" name=\"properties\" type=\"as\" />"
+"    <arg direction=\"out\" name=\"values\" type=\"a(oa{sv})\" />"
+"    "
+"  </method>"
+""
 "  <signal name=\"AddAccessible\">"
 "    <arg name=\"nodeAdded\" type=\"((so)(so)iiassusau)\" />"
 "    "
 "  </signal>"
 ""
+"  <method name=\"EnableBatchedSignals\">"
+"    "
+"  </method>"
+""
+"  <signal name=\"AddAccessibles\">"
+"    <arg name=\"nodesAdded\" type=\"a((so)(so)iiassusau)\" />"
+"    "
+"  </signal>"
+""
 "  <signal name=\"RemoveAccessible\">"
 "    <arg name=\"nodeRemoved\" type=\"(so)\" />"
 "    "
 "  </signal>"
 ""
+"  <signal name=\"RemoveSubtree\">"
+"    <arg name=\"rootRemoved\" type=\"(so)\" />"
+"    "
+"  </signal>"
+""
 "</interface>"
 "";
 
@@ -0,0 +1,245 @@
+#include <string.h>
+#include <glib.h>
+#include <dbus/dbus.h>
+
+#include "keystroke-listeners.h"
+
+#define TEST_BUS_ONE "test.bus.One"
+#define TEST_BUS_TWO "test.bus.Two"
+#define TEST_PATH    "/test/listener"
+
+#define KEYSYM_A     0x61
+#define KEYSYM_B     0x62
+#define KEYCODE_A    38
+#define KEYCODE_Q    24
+
+#define SHIFT_MASK   (1 << 0)
+#define CONTROL_MASK (1 << 2)
+
+#define PRESS        (1 << ATSPI_KEY_PRESSED)
+#define RELEASE      (1 << ATSPI_KEY_RELEASED)
+
+typedef struct _TestKey
+{
+  dbus_int32_t keycode;
+  dbus_int32_t keysym;
+  const char *keystring;
+} TestKey;
+
+/*
+ * Builds a listener struct as the registry sends it and hands it to
+ * spi_keystroke_listeners_add, or to spi_keystroke_listeners_remove.
+ */
+static void
+change_listener (gboolean add, const char *bus_name, dbus_uint32_t types,
+                 const TestKey *keys, guint n_keys, dbus_uint32_t mask,
+                 dbus_bool_t synchronous, dbus_bool_t preemptive)
+{
+  DBusMessage *message;
+  DBusMessageIter iter, iter_struct, iter_keys, iter_key, iter_mode;
+  const char *path = TEST_PATH;
+  dbus_uint32_t device_type = 0;
+  dbus_int32_t unused = 0;
+  dbus_bool_t global = FALSE;
+  guint i;
+
+  message = dbus_message_new_signal (TEST_PATH, "test.interface.Listeners",
+                                     "Changed");
+  g_assert (message != NULL);
+
+  dbus_message_iter_init_append (message, &iter);
+  dbus_message_iter_open_container (&iter, DBUS_TYPE_STRUCT, NULL,
+                                    &iter_struct);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &bus_name);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_OBJECT_PATH, &path);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_UINT32,
+                                  &device_type);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_UINT32, &types);
+  dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "(iisi)",
+                                    &iter_keys);
+  for (i = 0; i < n_keys; i++)
+    {
+      dbus_message_iter_open_container (&iter_keys, DBUS_TYPE_STRUCT, NULL,
+                                        &iter_key);
+      dbus_message_iter_append_basic (&iter_key, DBUS_TYPE_INT32,
+                                      &keys[i].keycode);
+      dbus_message_iter_append_basic (&iter_key, DBUS_TYPE_INT32,
+                                      &keys[i].keysym);
+      dbus_message_iter_append_basic (&iter_key, DBUS_TYPE_STRING,
+                                      &keys[i].keystring);
+      dbus_message_iter_append_basic (&iter_key, DBUS_TYPE_INT32, &unused);
+      dbus_message_iter_close_container (&iter_keys, &iter_key);
+    }
+  dbus_message_iter_close_container (&iter_struct, &iter_keys);
+  dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_UINT32, &mask);
+  dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_STRUCT, NULL,
+                                    &iter_mode);
+  dbus_message_iter_append_basic (&iter_mode, DBUS_TYPE_BOOLEAN, &synchronous);
+  dbus_message_iter_append_basic (&iter_mode, DBUS_TYPE_BOOLEAN, &preemptive);
+  dbus_message_iter_append_basic (&iter_mode, DBUS_TYPE_BOOLEAN, &global);
+  dbus_message_iter_close_container (&iter_struct, &iter_mode);
+  dbus_message_iter_close_container (&iter, &iter_struct);
+
+  dbus_message_iter_init (message, &iter);
+  if (add)
+    spi_keystroke_listeners_add (&iter);
+  else
+    spi_keystroke_listeners_remove (&iter);
+  dbus_message_unref (message);
+}
+
+static SpiKeystrokeMatch
+match_key (AtspiEventType type, guint keysym, gushort keycode,
+           gushort modifiers, const char *string)
+{
+  AtspiDeviceEvent event;
+
+  memset (&event, 0, sizeof (event));
+  event.type = type;
+  event.id = keysym;
+  event.hw_code = keycode;
+  event.modifiers = modifiers;
+  event.event_string = (gchar *) string;
+  return spi_keystroke_listeners_match (&event);
+}
+
+static SpiKeystrokeMatch
+press (guint keysym, gushort keycode, gushort modifiers)
+{
+  return match_key (ATSPI_KEY_PRESSED, keysym, keycode, modifiers, "");
+}
+
+static void
+test_unknown (void)
+{
+  spi_keystroke_listeners_reset ();
+
+  /* Before the registry has answered, any key may be consumed */
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+  g_assert_cmpint (press (KEYSYM_B, 0, CONTROL_MASK), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+
+  spi_keystroke_listeners_set_known ();
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NONE);
+
+  /* Forgetting the registry's listeners makes every key interesting again */
+  spi_keystroke_listeners_reset ();
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+}
+
+static void
+test_notify (void)
+{
+  TestKey keys[] = { { KEYCODE_A, KEYSYM_A, "a" } };
+
+  spi_keystroke_listeners_reset ();
+  spi_keystroke_listeners_set_known ();
+  change_listener (TRUE, TEST_BUS_ONE, PRESS, keys, 1, 0, FALSE, FALSE);
+
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NOTIFY);
+  g_assert_cmpint (press (KEYSYM_B, 0, 0), ==, SPI_KEYSTROKE_MATCH_NONE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, SHIFT_MASK), ==,
+                   SPI_KEYSTROKE_MATCH_NONE);
+  g_assert_cmpint (match_key (ATSPI_KEY_RELEASED, KEYSYM_A, KEYCODE_A,
+                              0, "a"), ==, SPI_KEYSTROKE_MATCH_NONE);
+
+  /* Modifier bits outside the ones the registry compares are ignored */
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0x1000), ==,
+                   SPI_KEYSTROKE_MATCH_NOTIFY);
+}
+
+static void
+test_consume (void)
+{
+  TestKey keys[] = { { KEYCODE_A, KEYSYM_A, "a" } };
+
+  spi_keystroke_listeners_reset ();
+  spi_keystroke_listeners_set_known ();
+  change_listener (TRUE, TEST_BUS_ONE, PRESS, keys, 1, 0, FALSE, FALSE);
+  /* No keys and no types: every key with control held down */
+  change_listener (TRUE, TEST_BUS_TWO, 0, NULL, 0, CONTROL_MASK, TRUE, TRUE);
+
+  g_assert_cmpint (press (KEYSYM_B, 0, CONTROL_MASK), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+  g_assert_cmpint (match_key (ATSPI_KEY_RELEASED, KEYSYM_B, 0,
+                              CONTROL_MASK, ""), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NOTIFY);
+  g_assert_cmpint (press (KEYSYM_B, 0, 0), ==, SPI_KEYSTROKE_MATCH_NONE);
+
+  /* Synchronous alone isn't enough to consume a key */
+  spi_keystroke_listeners_reset ();
+  spi_keystroke_listeners_set_known ();
+  change_listener (TRUE, TEST_BUS_ONE, PRESS | RELEASE, keys, 1, 0,
+                   TRUE, FALSE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NOTIFY);
+}
+
+static void
+test_keys (void)
+{
+  TestKey keys[] = { { KEYCODE_Q, 0, "q" } };
+
+  spi_keystroke_listeners_reset ();
+  spi_keystroke_listeners_set_known ();
+  change_listener (TRUE, TEST_BUS_ONE, PRESS, keys, 1, 0, TRUE, TRUE);
+
+  /* A key is matched by its keysym, its keycode or its string */
+  g_assert_cmpint (press (KEYSYM_B, KEYCODE_Q, 0), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+  g_assert_cmpint (match_key (ATSPI_KEY_PRESSED, KEYSYM_B, KEYCODE_A,
+                              0, "q"), ==, SPI_KEYSTROKE_MATCH_CONSUME);
+  g_assert_cmpint (match_key (ATSPI_KEY_PRESSED, KEYSYM_B, KEYCODE_A,
+                              0, "b"), ==, SPI_KEYSTROKE_MATCH_NONE);
+}
+
+static void
+test_remove (void)
+{
+  TestKey keys[] = { { KEYCODE_A, KEYSYM_A, "a" } };
+
+  spi_keystroke_listeners_reset ();
+  spi_keystroke_listeners_set_known ();
+
+  /* A registration is told apart by its mask */
+  change_listener (TRUE, TEST_BUS_ONE, PRESS, keys, 1, 0, FALSE, FALSE);
+  change_listener (TRUE, TEST_BUS_ONE, PRESS, keys, 1, SHIFT_MASK,
+                   FALSE, FALSE);
+  change_listener (FALSE, TEST_BUS_ONE, PRESS, keys, 1, 0, FALSE, FALSE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NONE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, SHIFT_MASK), ==,
+                   SPI_KEYSTROKE_MATCH_NOTIFY);
+
+  /* A client leaving the bus takes its listeners with it */
+  change_listener (TRUE, TEST_BUS_TWO, PRESS, keys, 1, 0, TRUE, TRUE);
+  spi_keystroke_listeners_remove_bus (TEST_BUS_ONE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, SHIFT_MASK), ==,
+                   SPI_KEYSTROKE_MATCH_NONE);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_CONSUME);
+
+  spi_keystroke_listeners_remove_bus (TEST_BUS_TWO);
+  g_assert_cmpint (press (KEYSYM_A, KEYCODE_A, 0), ==,
+                   SPI_KEYSTROKE_MATCH_NONE);
+}
+
+int
+main (int argc, char **argv)
+{
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/keystroke-listeners/unknown", test_unknown);
+  g_test_add_func ("/keystroke-listeners/notify", test_notify);
+  g_test_add_func ("/keystroke-listeners/consume", test_consume);
+  g_test_add_func ("/keystroke-listeners/keys", test_keys);
+  g_test_add_func ("/keystroke-listeners/remove", test_remove);
+
+  return g_test_run ();
+}
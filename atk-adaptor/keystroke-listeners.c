@@ -0,0 +1,384 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Keeps track of the keystroke listeners that ATs have registered with
+ * the registry daemon, as announced by GetKeystrokeListeners and the
+ * KeystrokeListenerRegistered / KeystrokeListenerDeregistered signals.
+ *
+ * The registry does the actual matching and delivery; the bridge only
+ * needs to know enough to decide how to forward a key event to it. For
+ * that the listeners are compiled into a filter that tells, for a key
+ * event, whether any listener could match it, and whether such a
+ * listener could consume it. The filter errs on the side of matching:
+ * keys, modifiers and event types are checked the way the registry
+ * checks them, but whether a listener is global is ignored.
+ */
+
+#include <string.h>
+
+#include "keystroke-listeners.h"
+
+/* Only these modifier bits take part in matching, as in the registry */
+#define MODIFIER_MASK 0x0FFF
+
+typedef struct _SpiKeyDefinition
+{
+  dbus_int32_t keycode;
+  dbus_int32_t keysym;
+  gchar *keystring;
+} SpiKeyDefinition;
+
+typedef struct _SpiKeystrokeListener
+{
+  gchar *bus_name;
+  gchar *path;
+  dbus_uint32_t types;
+  dbus_uint32_t mask;
+  GArray *keys;
+  dbus_bool_t synchronous;
+  dbus_bool_t preemptive;
+} SpiKeystrokeListener;
+
+/*
+ * The compiled filter. Each table maps a key (keysym, keycode or key
+ * string) to a GPtrArray of the listeners that ask for it; listeners
+ * that don't name any keys are in any_key.
+ */
+typedef struct _SpiKeystrokeFilter
+{
+  GPtrArray *any_key;
+  GHashTable *by_keysym;
+  GHashTable *by_keycode;
+  GHashTable *by_keystring;
+} SpiKeystrokeFilter;
+
+static GList *listeners = NULL;
+static gboolean listeners_known = FALSE;
+static SpiKeystrokeFilter *filter = NULL;
+
+static void
+listener_free (SpiKeystrokeListener *listener)
+{
+  guint i;
+
+  for (i = 0; i < listener->keys->len; i++)
+    g_free (g_array_index (listener->keys, SpiKeyDefinition, i).keystring);
+  g_array_free (listener->keys, TRUE);
+  g_free (listener->bus_name);
+  g_free (listener->path);
+  g_free (listener);
+}
+
+static void
+filter_free (SpiKeystrokeFilter *f)
+{
+  g_ptr_array_free (f->any_key, TRUE);
+  g_hash_table_destroy (f->by_keysym);
+  g_hash_table_destroy (f->by_keycode);
+  g_hash_table_destroy (f->by_keystring);
+  g_free (f);
+}
+
+static void
+invalidate_filter (void)
+{
+  if (filter)
+    {
+      filter_free (filter);
+      filter = NULL;
+    }
+}
+
+static void
+filter_add (GHashTable *table, gpointer key, SpiKeystrokeListener *listener)
+{
+  GPtrArray *array = g_hash_table_lookup (table, key);
+
+  if (!array)
+    {
+      array = g_ptr_array_new ();
+      g_hash_table_insert (table, key, array);
+    }
+  g_ptr_array_add (array, listener);
+}
+
+static SpiKeystrokeFilter *
+compile_filter (void)
+{
+  SpiKeystrokeFilter *f = g_new (SpiKeystrokeFilter, 1);
+  GList *l;
+  guint i;
+
+  f->any_key = g_ptr_array_new ();
+  f->by_keysym = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                        (GDestroyNotify) g_ptr_array_unref);
+  f->by_keycode = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL,
+                                         (GDestroyNotify) g_ptr_array_unref);
+  f->by_keystring = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                           (GDestroyNotify) g_ptr_array_unref);
+
+  for (l = listeners; l; l = l->next)
+    {
+      SpiKeystrokeListener *listener = l->data;
+
+      if (listener->keys->len == 0)
+        {
+          g_ptr_array_add (f->any_key, listener);
+          continue;
+        }
+
+      for (i = 0; i < listener->keys->len; i++)
+        {
+          SpiKeyDefinition *key = &g_array_index (listener->keys,
+                                                  SpiKeyDefinition, i);
+
+          filter_add (f->by_keysym, GINT_TO_POINTER (key->keysym), listener);
+          filter_add (f->by_keycode, GINT_TO_POINTER (key->keycode), listener);
+          if (key->keystring && key->keystring[0])
+            filter_add (f->by_keystring, key->keystring, listener);
+        }
+    }
+
+  return f;
+}
+
+/*
+ * Reads a listener from a struct of type SPI_KEYSTROKE_LISTENER_SIGNATURE.
+ * Returns NULL if the message doesn't hold one.
+ */
+static SpiKeystrokeListener *
+listener_from_iter (DBusMessageIter *iter)
+{
+  SpiKeystrokeListener *listener;
+  DBusMessageIter iter_struct, iter_keys, iter_mode;
+  const char *bus_name, *path;
+  char *signature;
+  gboolean matches;
+
+  signature = dbus_message_iter_get_signature (iter);
+  matches = !strcmp (signature, SPI_KEYSTROKE_LISTENER_SIGNATURE);
+  dbus_free (signature);
+  if (!matches)
+    return NULL;
+
+  dbus_message_iter_recurse (iter, &iter_struct);
+  dbus_message_iter_get_basic (&iter_struct, &bus_name);
+  dbus_message_iter_next (&iter_struct);
+  dbus_message_iter_get_basic (&iter_struct, &path);
+  dbus_message_iter_next (&iter_struct);
+
+  listener = g_new0 (SpiKeystrokeListener, 1);
+  listener->bus_name = g_strdup (bus_name);
+  listener->path = g_strdup (path);
+
+  listener->keys = g_array_new (FALSE, FALSE, sizeof (SpiKeyDefinition));
+
+  /* Skip the device type */
+  dbus_message_iter_next (&iter_struct);
+  dbus_message_iter_get_basic (&iter_struct, &listener->types);
+  dbus_message_iter_next (&iter_struct);
+
+  dbus_message_iter_recurse (&iter_struct, &iter_keys);
+  while (dbus_message_iter_get_arg_type (&iter_keys) != DBUS_TYPE_INVALID)
+    {
+      DBusMessageIter iter_key;
+      SpiKeyDefinition key;
+      const char *keystring;
+
+      dbus_message_iter_recurse (&iter_keys, &iter_key);
+      dbus_message_iter_get_basic (&iter_key, &key.keycode);
+      dbus_message_iter_next (&iter_key);
+      dbus_message_iter_get_basic (&iter_key, &key.keysym);
+      dbus_message_iter_next (&iter_key);
+      dbus_message_iter_get_basic (&iter_key, &keystring);
+      key.keystring = g_strdup (keystring);
+      g_array_append_val (listener->keys, key);
+      dbus_message_iter_next (&iter_keys);
+    }
+  dbus_message_iter_next (&iter_struct);
+
+  dbus_message_iter_get_basic (&iter_struct, &listener->mask);
+  dbus_message_iter_next (&iter_struct);
+
+  dbus_message_iter_recurse (&iter_struct, &iter_mode);
+  dbus_message_iter_get_basic (&iter_mode, &listener->synchronous);
+  dbus_message_iter_next (&iter_mode);
+  dbus_message_iter_get_basic (&iter_mode, &listener->preemptive);
+
+  return listener;
+}
+
+/*
+ * An AT may register the same listener object several times, typically
+ * once for each modifier mask it is interested in, so a registration is
+ * identified by its bus name, path and mask.
+ */
+static GList *
+find_listener (SpiKeystrokeListener *like)
+{
+  GList *l;
+
+  for (l = listeners; l; l = l->next)
+    {
+      SpiKeystrokeListener *listener = l->data;
+
+      if (!strcmp (listener->bus_name, like->bus_name) &&
+          !strcmp (listener->path, like->path) &&
+          listener->mask == like->mask)
+        return l;
+    }
+  return NULL;
+}
+
+void
+spi_keystroke_listeners_add (DBusMessageIter *iter)
+{
+  SpiKeystrokeListener *listener = listener_from_iter (iter);
+
+  if (!listener)
+    return;
+
+  listeners = g_list_prepend (listeners, listener);
+  invalidate_filter ();
+}
+
+void
+spi_keystroke_listeners_remove (DBusMessageIter *iter)
+{
+  SpiKeystrokeListener *listener = listener_from_iter (iter);
+  GList *l;
+
+  if (!listener)
+    return;
+
+  l = find_listener (listener);
+  if (l)
+    {
+      invalidate_filter ();
+      listener_free (l->data);
+      listeners = g_list_delete_link (listeners, l);
+    }
+  listener_free (listener);
+}
+
+void
+spi_keystroke_listeners_remove_bus (const char *bus_name)
+{
+  GList *l, *next;
+
+  for (l = listeners; l; l = next)
+    {
+      SpiKeystrokeListener *listener = l->data;
+
+      next = l->next;
+      if (!strcmp (listener->bus_name, bus_name))
+        {
+          invalidate_filter ();
+          listener_free (listener);
+          listeners = g_list_delete_link (listeners, l);
+        }
+    }
+}
+
+/*
+ * Called once the registry has told us which keystroke listeners exist.
+ * Until then every key event has to be assumed to be of interest.
+ */
+void
+spi_keystroke_listeners_set_known (void)
+{
+  listeners_known = TRUE;
+}
+
+/*
+ * Forgets all listeners, for when the registry has gone away. Key events
+ * are assumed to be of interest until it tells us about listeners again.
+ */
+void
+spi_keystroke_listeners_reset (void)
+{
+  invalidate_filter ();
+  g_list_free_full (listeners, (GDestroyNotify) listener_free);
+  listeners = NULL;
+  listeners_known = FALSE;
+}
+
+static void
+match_listeners (GPtrArray *array, const AtspiDeviceEvent *event,
+                 SpiKeystrokeMatch *match)
+{
+  guint i;
+
+  if (!array)
+    return;
+
+  for (i = 0; i < array->len && *match != SPI_KEYSTROKE_MATCH_CONSUME; i++)
+    {
+      SpiKeystrokeListener *listener = g_ptr_array_index (array, i);
+
+      if ((event->modifiers & MODIFIER_MASK) != (listener->mask & MODIFIER_MASK))
+        continue;
+      if (listener->types && !(listener->types & (1 << event->type)))
+        continue;
+
+      if (listener->synchronous && listener->preemptive)
+        *match = SPI_KEYSTROKE_MATCH_CONSUME;
+      else
+        *match = SPI_KEYSTROKE_MATCH_NOTIFY;
+    }
+}
+
+/*
+ * Tells whether any registered listener could match the key event, and
+ * if so whether one of them could consume it.
+ */
+SpiKeystrokeMatch
+spi_keystroke_listeners_match (const AtspiDeviceEvent *event)
+{
+  SpiKeystrokeMatch match = SPI_KEYSTROKE_MATCH_NONE;
+
+  if (!listeners_known)
+    return SPI_KEYSTROKE_MATCH_CONSUME;
+
+  if (!listeners)
+    return SPI_KEYSTROKE_MATCH_NONE;
+
+  if (!filter)
+    filter = compile_filter ();
+
+  match_listeners (filter->any_key, event, &match);
+  match_listeners (g_hash_table_lookup (filter->by_keysym,
+                                        GINT_TO_POINTER (event->id)),
+                   event, &match);
+  match_listeners (g_hash_table_lookup (filter->by_keycode,
+                                        GINT_TO_POINTER (event->hw_code)),
+                   event, &match);
+  if (event->event_string && event->event_string[0])
+    match_listeners (g_hash_table_lookup (filter->by_keystring,
+                                          event->event_string),
+                     event, &match);
+
+  return match;
+}
+
+/*END------------------------------------------------------------------------*/
@@ -0,0 +1,47 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef KEYSTROKE_LISTENERS_H
+#define KEYSTROKE_LISTENERS_H
+
+#include <glib.h>
+#include <dbus/dbus.h>
+#include <atspi/atspi.h>
+
+#define SPI_KEYSTROKE_LISTENER_SIGNATURE "(souua(iisi)u(bbb))"
+
+typedef enum
+{
+  SPI_KEYSTROKE_MATCH_NONE,
+  SPI_KEYSTROKE_MATCH_NOTIFY,
+  SPI_KEYSTROKE_MATCH_CONSUME
+} SpiKeystrokeMatch;
+
+void spi_keystroke_listeners_add (DBusMessageIter *iter);
+void spi_keystroke_listeners_remove (DBusMessageIter *iter);
+void spi_keystroke_listeners_remove_bus (const char *bus_name);
+void spi_keystroke_listeners_set_known (void);
+void spi_keystroke_listeners_reset (void);
+
+SpiKeystrokeMatch spi_keystroke_listeners_match (const AtspiDeviceEvent *event);
+
+#endif /* KEYSTROKE_LISTENERS_H */
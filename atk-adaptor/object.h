@@ -34,7 +34,7 @@ void
 spi_object_append_reference (DBusMessageIter * iter, AtkObject * obj);
 
 void
-spi_hyperlink_append_reference (DBusMessageIter * iter, AtkObject * obj);
+spi_hyperlink_append_reference (DBusMessageIter * iter, AtkHyperlink * obj);
 
 void
 spi_object_append_v_reference (DBusMessageIter * iter, AtkObject * obj);
@@ -51,6 +51,11 @@ spi_object_return_reference (DBusMessage * msg, AtkObject * obj);
 DBusMessage *
 spi_hyperlink_return_reference (DBusMessage * msg, AtkHyperlink * obj);
 
+#define SPI_OBJECT_MAX_INTERFACES 16
+
+guint
+spi_object_get_interfaces (AtkObject * obj, const gchar ** interfaces);
+
 void
 spi_object_append_interfaces (DBusMessageIter * iter, AtkObject * obj);
 
@@ -28,6 +28,37 @@
 #include <dbus/dbus.h>
 
 #include <atspi/atspi.h>
+#include <droute/droute.h>
+
+static gboolean count_bytes = FALSE;
+static guint64 bytes_sent = 0;
+
+/*
+ * Sends a message without waiting for a reply, counting its size once
+ * spi_dbus_set_count_bytes has turned counting on.
+ */
+dbus_bool_t
+spi_dbus_send (DBusConnection *bus, DBusMessage *message)
+{
+  dbus_bool_t ret;
+
+  ret = dbus_connection_send (bus, message, NULL);
+  if (ret && count_bytes)
+    bytes_sent += droute_message_size (message);
+  return ret;
+}
+
+void
+spi_dbus_set_count_bytes (gboolean enable)
+{
+  count_bytes = enable;
+}
+
+guint64
+spi_dbus_get_bytes_sent (void)
+{
+  return bytes_sent;
+}
 
 DBusMessage *
 spi_dbus_general_error (DBusMessage * message)
@@ -69,6 +100,10 @@ oom:
   return reply;
 }
 
+/*
+ * Sends a signal straight to the connection, bypassing the event queue's
+ * limits, so it mustn't be used for events. See event.c.
+ */
 void spi_dbus_emit_valist(DBusConnection *bus, const char *path, const char *interface, const char *name, int first_arg_type, va_list args)
 {
   DBusMessage *sig;
@@ -78,7 +113,7 @@ void spi_dbus_emit_valist(DBusConnection *bus, const char *path, const char *int
   {
     dbus_message_append_args_valist(sig, first_arg_type, args);
   }
-  dbus_connection_send(bus, sig, NULL);
+  spi_dbus_send(bus, sig);
   dbus_message_unref(sig);
 }
 
@@ -252,7 +287,7 @@ spi_dbus_emit_signal(DBusConnection *bus, const char *path,
   dbus_message_iter_append_basic(&sub, (int) *type, &val);
   dbus_message_iter_close_container(&iter, &sub);
 
-  dbus_connection_send(bus, sig, NULL);
+  spi_dbus_send(bus, sig);
   dbus_message_unref(sig);
 }
 
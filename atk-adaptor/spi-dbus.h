@@ -38,6 +38,15 @@ extern int _dbg;
 #define SPI_DBUS_PATH_NULL "/org/a11y/atspi/null"
 #define SPI_DBUS_PATH_ROOT "/org/a11y/atspi/accessible/root"
 
+#define SPI_DBUS_PATH_BRIDGE "/org/a11y/atspi/bridge"
+#define SPI_DBUS_INTERFACE_BRIDGE_STATS "org.a11y.atspi.BridgeStats"
+#define SPI_DBUS_INTERFACE_EVENT_BATCH "org.a11y.atspi.EventBatch"
+#define SPI_DBUS_INTERFACE_EVENT_QUEUE "org.a11y.atspi.EventQueue"
+
+dbus_bool_t spi_dbus_send(DBusConnection *bus, DBusMessage *message);
+void spi_dbus_set_count_bytes(gboolean enable);
+guint64 spi_dbus_get_bytes_sent(void);
+
 DBusMessage *spi_dbus_general_error(DBusMessage *message);
 DBusMessage *spi_dbus_return_rect(DBusMessage *message, gint ix, gint iy, gint iwidth, gint iheight);
 
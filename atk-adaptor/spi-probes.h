@@ -0,0 +1,63 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef SPI_PROBES_H_
+#define SPI_PROBES_H_
+
+/*
+ * Static probes for perf, bpftrace and SystemTap, in the atk_bridge
+ * provider. A probe that nothing is attached to is a single no-op
+ * instruction, so its arguments should be values already at hand.
+ *
+ *   event_decided (klass, major, minor, needed)
+ *   event_emitted (klass, major, minor, path)
+ *   cache_add (object), cache_remove (object)
+ *   lease_take (object, expiry_s, renewed)
+ *   lease_expire (object), lease_evict (object)
+ *   key_start (type, keysym, sync)
+ *   key_finish (keysym, consumed, time_us, sync)
+ *
+ * The method entry and return probes are in droute, in the droute
+ * provider.
+ */
+
+#include "config.h"
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define SPI_PROBE1(name, a) \
+  DTRACE_PROBE1 (atk_bridge, name, a)
+#define SPI_PROBE3(name, a, b, c) \
+  DTRACE_PROBE3 (atk_bridge, name, a, b, c)
+#define SPI_PROBE4(name, a, b, c, d) \
+  DTRACE_PROBE4 (atk_bridge, name, a, b, c, d)
+
+#else
+
+#define SPI_PROBE1(name, a)
+#define SPI_PROBE3(name, a, b, c)
+#define SPI_PROBE4(name, a, b, c, d)
+
+#endif /* HAVE_SYS_SDT_H */
+
+#endif /* SPI_PROBES_H_ */
@@ -0,0 +1,235 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Records timed spans of what the bridge does, for finding where the time
+ * goes when an application is slow with an AT running.
+ *
+ * Tracing is turned on by setting AT_SPI_TRACE to a file name. Spans are
+ * kept in a ring buffer of AT_SPI_TRACE_SIZE entries (65536 by default),
+ * the oldest being overwritten once it is full. The buffer is written to
+ * "<AT_SPI_TRACE>.<pid>" in the Chrome trace event format, which Perfetto
+ * and chrome://tracing load, when the process exits and whenever it gets
+ * SIGUSR2.
+ *
+ * Writers claim a slot with an atomic increment and never wait. Each
+ * entry carries the sequence number it was written for, which is cleared
+ * while it is being filled in, so that the dump skips entries that are
+ * being overwritten underneath it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <glib.h>
+#if GLIB_CHECK_VERSION (2, 36, 0)
+#include <glib-unix.h>
+#endif
+
+#include "spi-trace.h"
+
+#define TRACE_SIZE 65536
+
+typedef struct _SpiTraceEntry SpiTraceEntry;
+struct _SpiTraceEntry
+{
+  volatile gint seq;
+  guint tid;
+  const gchar *name;
+  const gchar *category;
+  const gchar *detail;
+  gint64 start_us;
+  gint64 end_us;
+};
+
+gboolean spi_trace_active = FALSE;
+
+static SpiTraceEntry *entries = NULL;
+static guint n_entries;
+static volatile gint head = 0;
+static gchar *trace_filename = NULL;
+
+static volatile gint n_threads = 0;
+static GPrivate thread_id;
+
+static guint
+get_thread_id (void)
+{
+  guint tid = GPOINTER_TO_UINT (g_private_get (&thread_id));
+
+  if (!tid)
+    {
+      tid = g_atomic_int_add (&n_threads, 1) + 1;
+      g_private_set (&thread_id, GUINT_TO_POINTER (tid));
+    }
+  return tid;
+}
+
+void
+spi_trace_record (const gchar *name, const gchar *category,
+                  const gchar *detail, gint64 start_us, gint64 end_us)
+{
+  guint seq;
+  SpiTraceEntry *entry;
+
+  if (!spi_trace_active)
+    return;
+
+  seq = (guint) g_atomic_int_add (&head, 1);
+  entry = &entries[seq & (n_entries - 1)];
+
+  g_atomic_int_set (&entry->seq, 0);
+  entry->tid = get_thread_id ();
+  entry->name = name;
+  entry->category = category;
+  entry->detail = detail;
+  entry->start_us = start_us;
+  entry->end_us = end_us;
+  g_atomic_int_set (&entry->seq, seq + 1);
+}
+
+static void
+write_string (FILE *file, const gchar *str)
+{
+  fputc ('"', file);
+  for (; str && *str; str++)
+    {
+      if (*str == '"' || *str == '\\')
+        fprintf (file, "\\%c", *str);
+      else if ((guchar) *str < 0x20)
+        fprintf (file, "\\u%04x", (guchar) *str);
+      else
+        fputc (*str, file);
+    }
+  fputc ('"', file);
+}
+
+/*
+ * Writes the spans currently in the buffer to the trace file, replacing
+ * whatever an earlier dump wrote.
+ */
+gboolean
+spi_trace_dump (void)
+{
+  FILE *file;
+  guint end, seq;
+  gboolean first = TRUE;
+  gint pid = getpid ();
+
+  if (!spi_trace_active)
+    return FALSE;
+
+  file = fopen (trace_filename, "w");
+  if (!file)
+    {
+      g_warning ("atk-bridge: could not write trace to %s", trace_filename);
+      return FALSE;
+    }
+
+  fprintf (file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+  end = (guint) g_atomic_int_get (&head);
+  for (seq = (end > n_entries ? end - n_entries : 0); seq != end; seq++)
+    {
+      SpiTraceEntry *slot = &entries[seq & (n_entries - 1)];
+      SpiTraceEntry entry;
+
+      if (g_atomic_int_get (&slot->seq) != seq + 1)
+        continue;
+      entry = *slot;
+      if (g_atomic_int_get (&slot->seq) != seq + 1)
+        continue;
+
+      fprintf (file, "%s\n{\"ph\":\"X\",\"pid\":%d,\"tid\":%u,\"name\":",
+               first ? "" : ",", pid, entry.tid);
+      write_string (file, entry.name);
+      fprintf (file, ",\"cat\":");
+      write_string (file, entry.category);
+      fprintf (file, ",\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT,
+               entry.start_us, MAX (entry.end_us - entry.start_us, 0));
+      if (entry.detail)
+        {
+          fprintf (file, ",\"args\":{\"detail\":");
+          write_string (file, entry.detail);
+          fputc ('}', file);
+        }
+      fputc ('}', file);
+      first = FALSE;
+    }
+
+  fprintf (file, "\n]}\n");
+  fclose (file);
+  return TRUE;
+}
+
+static void
+dump_at_exit (void)
+{
+  spi_trace_dump ();
+}
+
+#if GLIB_CHECK_VERSION (2, 36, 0)
+static gboolean
+dump_on_signal (gpointer data)
+{
+  spi_trace_dump ();
+  return TRUE;
+}
+#endif
+
+/*
+ * Starts tracing if AT_SPI_TRACE is set. Only the first call does
+ * anything, so the buffer survives the bridge being reloaded.
+ */
+void
+spi_trace_init (void)
+{
+  static gboolean inited = FALSE;
+  const gchar *envvar;
+  guint size = TRACE_SIZE;
+
+  if (inited)
+    return;
+  inited = TRUE;
+
+  envvar = g_getenv ("AT_SPI_TRACE");
+  if (!envvar || !envvar[0])
+    return;
+
+  if (g_getenv ("AT_SPI_TRACE_SIZE"))
+    size = MAX (atoi (g_getenv ("AT_SPI_TRACE_SIZE")), 1);
+
+  /* Indexing the ring by masking needs a power of two */
+  for (n_entries = 1; n_entries < size && n_entries < (1u << 30); n_entries <<= 1)
+    ;
+  entries = g_new0 (SpiTraceEntry, n_entries);
+  trace_filename = g_strdup_printf ("%s.%d", envvar, (gint) getpid ());
+  spi_trace_active = TRUE;
+
+  atexit (dump_at_exit);
+#if GLIB_CHECK_VERSION (2, 36, 0)
+  g_unix_signal_add (SIGUSR2, dump_on_signal, NULL);
+#endif
+}
@@ -0,0 +1,51 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008, 2009 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#ifndef SPI_TRACE_H_
+#define SPI_TRACE_H_
+
+#include <glib.h>
+
+extern gboolean spi_trace_active;
+
+/*
+ * Spans are timed with spi_trace_begin and spi_trace_end, which cost a
+ * single test while tracing is off. The strings given for a span are kept
+ * until the trace is written, so they must live as long as the bridge.
+ */
+#define spi_trace_begin() \
+  (G_UNLIKELY (spi_trace_active) ? g_get_monotonic_time () : 0)
+
+#define spi_trace_end(name, category, detail, start) G_STMT_START { \
+  if (G_UNLIKELY (start))                                            \
+    spi_trace_record ((name), (category), (detail), (start),         \
+                      g_get_monotonic_time ());                      \
+} G_STMT_END
+
+void spi_trace_init (void);
+
+void spi_trace_record (const gchar *name, const gchar *category,
+                       const gchar *detail, gint64 start_us, gint64 end_us);
+
+gboolean spi_trace_dump (void);
+
+#endif /* SPI_TRACE_H_ */
@@ -0,0 +1,250 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; http://developer.gnome.org/projects/gap)
+ *
+ * Copyright 2008 Codethink Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+/*
+ * Microbenchmark for droute method dispatch.
+ *
+ * Registers a path with a number of interfaces resembling the bridge's own
+ * and times routing a mix of method calls and property Gets through
+ * droute_path_dispatch, compared with the string-pair hash lookups and
+ * strcmp chain that droute used before names were interned.
+ *
+ * Usage: droute-bench [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <droute/droute.h>
+
+#include "droute-pairhash.h"
+
+#define BENCH_OBJECT_PATH  "/org/a11y/atspi/accessible/1"
+#define BENCH_INTERFACES   12
+#define BENCH_METHODS      16
+#define BENCH_PROPERTIES   4
+#define BENCH_ITERATIONS   200000
+
+static const char *method_names[BENCH_METHODS] = {
+    "GetChildAtIndex", "GetChildren", "GetIndexInParent", "GetRelationSet",
+    "GetRole", "GetRoleName", "GetLocalizedRoleName", "GetState",
+    "GetAttributes", "GetApplication", "GetExtents", "GetPosition",
+    "GetSize", "GetLayer", "GetMDIZOrder", "GrabFocus"
+};
+
+static const char *property_names[BENCH_PROPERTIES] = {
+    "Name", "Description", "Parent", "ChildCount"
+};
+
+static DBusMessage *
+bench_method (DBusConnection *bus, DBusMessage *message, void *user_data)
+{
+    return dbus_message_new_method_return (message);
+}
+
+static dbus_bool_t
+bench_property (DBusMessageIter *iter, void *user_data)
+{
+    return droute_return_v_int32 (iter, 0);
+}
+
+/*---------------------------------------------------------------------------*/
+
+/* The lookup structure droute used before interning names */
+typedef struct _LegacyPath
+{
+    GHashTable *methods;
+    GHashTable *properties;
+} LegacyPath;
+
+static DBusMessage *
+legacy_dispatch (LegacyPath *legacy, DBusMessage *message)
+{
+    const gchar *iface = dbus_message_get_interface (message);
+    const gchar *member = dbus_message_get_member (message);
+    StrPair pair;
+
+    if (!strcmp (iface, DBUS_INTERFACE_PROPERTIES))
+      {
+        DRoutePropertyFunction get;
+        DBusMessageIter iter;
+        DBusMessage *reply;
+
+        if (strcmp (member, "Get"))
+            return NULL;
+        dbus_message_get_args (message, NULL, DBUS_TYPE_STRING, &pair.one,
+                               DBUS_TYPE_STRING, &pair.two, DBUS_TYPE_INVALID);
+        get = g_hash_table_lookup (legacy->properties, &pair);
+        if (!get)
+            return NULL;
+        reply = dbus_message_new_method_return (message);
+        dbus_message_iter_init_append (reply, &iter);
+        get (&iter, NULL);
+        return reply;
+      }
+    else if (!strcmp (iface, DBUS_INTERFACE_INTROSPECTABLE))
+        return NULL;
+    else
+      {
+        DRouteFunction func;
+
+        pair.one = iface;
+        pair.two = member;
+        func = g_hash_table_lookup (legacy->methods, &pair);
+        return func ? func (NULL, message, NULL) : NULL;
+      }
+}
+
+/*---------------------------------------------------------------------------*/
+
+static gdouble
+run (const char *label, DRoutePath *path, LegacyPath *legacy,
+     DBusMessage **messages, guint n_messages, guint iterations)
+{
+    gint64 start, elapsed;
+    gdouble rate;
+    guint i;
+
+    start = g_get_monotonic_time ();
+    for (i = 0; i < iterations; i++)
+      {
+        DBusMessage *message = messages[i % n_messages];
+        DBusMessage *reply = NULL;
+
+        if (path)
+            droute_path_dispatch (path, NULL, message, &reply);
+        else
+            reply = legacy_dispatch (legacy, message);
+
+        if (!reply)
+            g_error ("droute-bench: %s failed to route %s.%s", label,
+                     dbus_message_get_interface (message),
+                     dbus_message_get_member (message));
+        dbus_message_unref (reply);
+      }
+    elapsed = g_get_monotonic_time () - start;
+
+    rate = (gdouble) iterations * G_USEC_PER_SEC / MAX (elapsed, 1);
+    printf ("%-10s %10u calls %10.3f s %12.0f calls/s\n", label, iterations,
+            (gdouble) elapsed / G_USEC_PER_SEC, rate);
+    return rate;
+}
+
+int
+main (int argc, char **argv)
+{
+    DRouteContext *cnx;
+    DRoutePath *path;
+    LegacyPath legacy;
+    DRouteMethod methods[BENCH_METHODS + 1];
+    DRouteProperty properties[BENCH_PROPERTIES + 1];
+    GPtrArray *messages;
+    gchar *interfaces[BENCH_INTERFACES];
+    guint iterations = BENCH_ITERATIONS;
+    gdouble before, after;
+    gint i, j;
+
+    if (argc > 1)
+        iterations = atoi (argv[1]);
+
+    cnx = droute_new ();
+    path = droute_add_one (cnx, BENCH_OBJECT_PATH, &legacy);
+    legacy.methods = g_hash_table_new_full ((GHashFunc) str_pair_hash,
+                                            str_pair_equal, g_free, NULL);
+    legacy.properties = g_hash_table_new_full ((GHashFunc) str_pair_hash,
+                                               str_pair_equal, g_free, NULL);
+    messages = g_ptr_array_new ();
+
+    for (j = 0; j < BENCH_METHODS; j++)
+      {
+        methods[j].func = bench_method;
+        methods[j].name = method_names[j];
+      }
+    methods[BENCH_METHODS].func = NULL;
+    methods[BENCH_METHODS].name = NULL;
+
+    for (j = 0; j < BENCH_PROPERTIES; j++)
+      {
+        properties[j].get = bench_property;
+        properties[j].set = NULL;
+        properties[j].name = property_names[j];
+      }
+    properties[BENCH_PROPERTIES].get = NULL;
+    properties[BENCH_PROPERTIES].set = NULL;
+    properties[BENCH_PROPERTIES].name = NULL;
+
+    for (i = 0; i < BENCH_INTERFACES; i++)
+      {
+        interfaces[i] = g_strdup_printf ("org.a11y.atspi.Bench%d", i);
+        droute_path_add_interface (path, interfaces[i], NULL,
+                                   methods, properties);
+
+        for (j = 0; j < BENCH_METHODS; j++)
+          {
+            DBusMessage *message;
+
+            g_hash_table_insert (legacy.methods,
+                                 str_pair_new (interfaces[i], method_names[j]),
+                                 bench_method);
+            message = dbus_message_new_method_call (NULL, BENCH_OBJECT_PATH,
+                                                    interfaces[i],
+                                                    method_names[j]);
+            g_ptr_array_add (messages, message);
+          }
+
+        for (j = 0; j < BENCH_PROPERTIES; j++)
+          {
+            DBusMessage *message;
+
+            g_hash_table_insert (legacy.properties,
+                                 str_pair_new (interfaces[i], property_names[j]),
+                                 bench_property);
+            message = dbus_message_new_method_call (NULL, BENCH_OBJECT_PATH,
+                                                    DBUS_INTERFACE_PROPERTIES,
+                                                    "Get");
+            dbus_message_append_args (message,
+                                      DBUS_TYPE_STRING, &interfaces[i],
+                                      DBUS_TYPE_STRING, &property_names[j],
+                                      DBUS_TYPE_INVALID);
+            g_ptr_array_add (messages, message);
+          }
+      }
+
+    printf ("%d interfaces, %d methods and %d properties each\n",
+            BENCH_INTERFACES, BENCH_METHODS, BENCH_PROPERTIES);
+
+    before = run ("strpair", NULL, &legacy, (DBusMessage **) messages->pdata,
+                  messages->len, iterations);
+    after = run ("interned", path, NULL, (DBusMessage **) messages->pdata,
+                 messages->len, iterations);
+    printf ("speedup    %.2fx\n", after / MAX (before, 1.0));
+
+    g_ptr_array_foreach (messages, (GFunc) dbus_message_unref, NULL);
+    g_ptr_array_free (messages, TRUE);
+    g_hash_table_destroy (legacy.methods);
+    g_hash_table_destroy (legacy.properties);
+    for (i = 0; i < BENCH_INTERFACES; i++)
+        g_free (interfaces[i]);
+    droute_free (cnx);
+    return 0;
+}
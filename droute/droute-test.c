@@ -64,6 +64,7 @@ typedef struct _AnObject
 static DBusConnection *bus;
 static GMainLoop      *main_loop;
 static gboolean       success = TRUE;
+static DRouteContext  *context;
 
 static DBusMessage *
 impl_null (DBusConnection *bus, DBusMessage *message, void *user_data)
@@ -185,6 +186,32 @@ static DRouteProperty test_properties[] = {
     {NULL, NULL, NULL}
 };
 
+typedef struct
+{
+    const char *interface;
+    const char *member;
+    guint64     calls;
+} CallCount;
+
+static void
+count_call (const char *interface, const char *member, guint64 calls,
+            guint64 time_us, void *user_data)
+{
+    CallCount *count = (CallCount *) user_data;
+
+    if (!strcmp (interface, count->interface) && !strcmp (member, count->member))
+        count->calls = calls;
+}
+
+static guint64
+get_call_count (const char *interface, const char *member)
+{
+    CallCount count = { interface, member, 0 };
+
+    droute_context_foreach_call_stats (context, count_call, &count);
+    return count.calls;
+}
+
 static void
 set_reply (DBusPendingCall *pending, void *user_data)
 {
@@ -258,6 +285,121 @@ do_tests_func (gpointer data)
 
     /* --------------------------------------------------------*/
 
+    result_string = NULL;
+    message = dbus_message_new_method_call (bus_name,
+                                            TEST_OBJECT_PATH,
+                                            DBUS_INTERFACE_INTROSPECTABLE,
+                                            "Introspect");
+    reply = send_and_allow_reentry (bus, message, NULL);
+    dbus_message_unref (message);
+    dbus_message_get_args (reply, NULL, DBUS_TYPE_STRING, &result_string,
+                           DBUS_TYPE_INVALID);
+    if (!result_string ||
+        !strstr (result_string, test_interface_One) ||
+        !g_str_has_suffix (result_string, "</node>"))
+    {
+            g_print ("Failed: unexpected introspection data %s\n",
+                     result_string);
+            exit (1);
+    }
+    dbus_message_unref (reply);
+
+    /* --------------------------------------------------------*/
+
+    message = dbus_message_new_method_call (bus_name,
+                                            TEST_OBJECT_PATH,
+                                            DROUTE_INTERFACE_MULTICALL,
+                                            "Multicall");
+    {
+        DBusMessageIter iter, iter_array, iter_struct, iter_args;
+        const char *calls[][3] = {
+            { TEST_OBJECT_PATH, TEST_INTERFACE_TWO, "getInterfaceTwo" },
+            { TEST_OBJECT_PATH, TEST_INTERFACE_TWO, "noSuchMethod" },
+            { TEST_OBJECT_PATH, TEST_INTERFACE_TWO, "a..b" }
+        };
+        gint i;
+
+        dbus_message_iter_init_append (message, &iter);
+        dbus_message_iter_open_container (&iter, DBUS_TYPE_ARRAY, "(ossav)", &iter_array);
+        for (i = 0; i < G_N_ELEMENTS (calls); i++)
+        {
+            dbus_message_iter_open_container (&iter_array, DBUS_TYPE_STRUCT, NULL, &iter_struct);
+            dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_OBJECT_PATH, &calls[i][0]);
+            dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &calls[i][1]);
+            dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &calls[i][2]);
+            dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "v", &iter_args);
+            dbus_message_iter_close_container (&iter_struct, &iter_args);
+            dbus_message_iter_close_container (&iter_array, &iter_struct);
+        }
+        dbus_message_iter_close_container (&iter, &iter_array);
+    }
+    reply = send_and_allow_reentry (bus, message, NULL);
+    dbus_message_unref (message);
+    {
+        DBusMessageIter iter, iter_array, iter_struct, iter_args, iter_variant;
+        const char *error_name;
+
+        if (strcmp (dbus_message_get_signature (reply), "a(sav)") != 0)
+        {
+            g_print ("Failed: Multicall reply has signature %s\n",
+                     dbus_message_get_signature (reply));
+            exit (1);
+        }
+        dbus_message_iter_init (reply, &iter);
+        dbus_message_iter_recurse (&iter, &iter_array);
+
+        dbus_message_iter_recurse (&iter_array, &iter_struct);
+        dbus_message_iter_get_basic (&iter_struct, &error_name);
+        dbus_message_iter_next (&iter_struct);
+        dbus_message_iter_recurse (&iter_struct, &iter_args);
+        dbus_message_iter_recurse (&iter_args, &iter_variant);
+        dbus_message_iter_get_basic (&iter_variant, &result_string);
+        if (error_name[0] || g_strcmp0 (result_string, TEST_INTERFACE_TWO))
+        {
+            g_print ("Failed: Multicall getInterfaceTwo returned %s %s\n",
+                     error_name, result_string);
+            exit (1);
+        }
+
+        dbus_message_iter_next (&iter_array);
+        dbus_message_iter_recurse (&iter_array, &iter_struct);
+        dbus_message_iter_get_basic (&iter_struct, &error_name);
+        if (strcmp (error_name, DBUS_ERROR_UNKNOWN_METHOD))
+        {
+            g_print ("Failed: Multicall noSuchMethod returned %s\n", error_name);
+            exit (1);
+        }
+
+        dbus_message_iter_next (&iter_array);
+        dbus_message_iter_recurse (&iter_array, &iter_struct);
+        dbus_message_iter_get_basic (&iter_struct, &error_name);
+        if (strcmp (error_name, DBUS_ERROR_INVALID_ARGS))
+        {
+            g_print ("Failed: Multicall with an invalid member returned %s\n",
+                     error_name);
+            exit (1);
+        }
+    }
+    dbus_message_unref (reply);
+
+    /* --------------------------------------------------------*/
+
+    if (get_call_count (TEST_INTERFACE_ONE, "getInterfaceOne") != 1 ||
+        get_call_count (TEST_INTERFACE_TWO, "getInterfaceTwo") != 1 ||
+        get_call_count (DROUTE_INTERFACE_MULTICALL, "Multicall") != 1 ||
+        get_call_count (TEST_INTERFACE_TWO, "noSuchMethod") != 0)
+    {
+            g_print ("Failed: unexpected call statistics\n");
+            exit (1);
+    }
+    if (droute_context_get_bytes_sent (context) == 0)
+    {
+            g_print ("Failed: no reply bytes were counted\n");
+            exit (1);
+    }
+
+    /* --------------------------------------------------------*/
+
 out:
     g_main_loop_quit (main_loop);
     return FALSE;
@@ -266,7 +408,6 @@ out:
 
 int main (int argc, char **argv)
 {
-    DRouteContext  *cnx;
     DRoutePath     *path;
     AnObject       *object;
     DBusError       error;
@@ -282,8 +423,9 @@ int main (int argc, char **argv)
     bus = dbus_bus_get (DBUS_BUS_SESSION, &error);
     atspi_dbus_connection_setup_with_g_main(bus, g_main_context_default());
 
-    cnx = droute_new ();
-    path = droute_add_one (cnx, TEST_OBJECT_PATH, object);
+    context = droute_new ();
+    droute_context_set_count_bytes (context, TRUE);
+    path = droute_add_one (context, TEST_OBJECT_PATH, object);
 
     droute_path_add_interface (path,
                                TEST_INTERFACE_ONE,
@@ -21,12 +21,13 @@
  * Boston, MA 02111-1307, USA.
  */
 
+#include "config.h"
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
 
 #include "droute.h"
-#include "droute-pairhash.h"
 
 #define CHUNKS_DEFAULT (512)
 
@@ -38,11 +39,54 @@
     #define _DROUTE_DEBUG(format, args...)
 #endif
 
+/*
+ * Static probes for perf, bpftrace and SystemTap, which cost a no-op
+ * instruction while nothing is attached:
+ *
+ *   method_entry (interface, member, path)
+ *   method_return (interface, member, path, handled)
+ */
+#ifdef HAVE_SYS_SDT_H
+    #include <sys/sdt.h>
+    #define _DROUTE_PROBE3(name, a, b, c) DTRACE_PROBE3 (droute, name, a, b, c)
+    #define _DROUTE_PROBE4(name, a, b, c, d) DTRACE_PROBE4 (droute, name, a, b, c, d)
+#else
+    #define _DROUTE_PROBE3(name, a, b, c)
+    #define _DROUTE_PROBE4(name, a, b, c, d)
+#endif
+
 struct _DRouteContext
 {
     GPtrArray            *registered_paths;
 
     gchar                *introspect_string;
+
+    /*
+     * Interface and member names are interned into small integers when an
+     * interface is added to a path, so dispatching an incoming message only
+     * needs a single string lookup per name followed by integer lookups.
+     */
+    GStringChunk         *chunks;
+    GHashTable           *names;
+    GPtrArray            *name_list;
+    guint                 n_names;
+
+    guint                 itf_properties;
+    guint                 itf_introspectable;
+    guint                 itf_multicall;
+    guint                 member_get;
+    guint                 member_set;
+    guint                 member_get_all;
+    guint                 member_introspect;
+    guint                 member_multicall;
+
+    /* Per interface and member call counts, keyed on both name ids */
+    GHashTable           *call_stats;
+    gboolean              count_bytes;
+    guint64               bytes_sent;
+
+    DRouteSpanFunction    span_func;
+    void                 *span_data;
 };
 
 struct _DRoutePath
@@ -50,11 +94,12 @@ struct _DRoutePath
     DRouteContext        *cnx;
     gchar *path;
     gboolean prefix;
-    GStringChunk         *chunks;
     GPtrArray            *interfaces;
-    GPtrArray            *introspection;
-    GHashTable           *methods;
-    GHashTable           *properties;
+    GHashTable           *interface_ids;
+
+    /* Interface introspection data, joined on first use */
+    gchar                *introspect_xml;
+    gsize                 introspect_xml_len;
 
     DRouteIntrospectChildrenFunction introspect_children_cb;
     void *introspect_children_data;
@@ -68,8 +113,30 @@ typedef struct PropertyPair
 {
     DRoutePropertyFunction get;
     DRoutePropertyFunction set;
+    const gchar *name;
 } PropertyPair;
 
+typedef struct _DRouteInterface DRouteInterface;
+struct _DRouteInterface
+{
+    guint                 id;
+    const gchar          *name;
+    const gchar          *introspect;
+    GHashTable           *methods;
+    GHashTable           *properties;
+    GPtrArray            *property_list;
+};
+
+typedef struct _DRouteCallStats DRouteCallStats;
+struct _DRouteCallStats
+{
+    guint64               key;
+    guint64               calls;
+    guint64               time_us;
+};
+
+#define CALL_STATS_KEY(iface, member) (((guint64) (iface) << 32) | (member))
+
 /*---------------------------------------------------------------------------*/
 
 static DBusHandlerResult
@@ -80,6 +147,75 @@ droute_object_does_not_exist_error (DBusMessage *message);
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Returns the integer id of an interface or member name, assigning a new
+ * one if the name has not been seen before. Id 0 is never assigned.
+ */
+static guint
+name_intern (DRouteContext *cnx, const gchar *name)
+{
+    gpointer id;
+    gchar *key;
+
+    id = g_hash_table_lookup (cnx->names, name);
+    if (id)
+        return GPOINTER_TO_UINT (id);
+
+    key = g_string_chunk_insert_const (cnx->chunks, name);
+    id = GUINT_TO_POINTER (++cnx->n_names);
+    g_hash_table_insert (cnx->names, key, id);
+    g_ptr_array_add (cnx->name_list, key);
+    return GPOINTER_TO_UINT (id);
+}
+
+/*
+ * Returns the integer id of an interface or member name, or 0 if no
+ * interface registered with this context uses the name.
+ */
+static guint
+name_lookup (DRouteContext *cnx, const gchar *name)
+{
+    if (name == NULL)
+        return 0;
+    return GPOINTER_TO_UINT (g_hash_table_lookup (cnx->names, name));
+}
+
+/*---------------------------------------------------------------------------*/
+
+static DRouteInterface *
+interface_new (guint id, const gchar *name, const gchar *introspect)
+{
+    DRouteInterface *itf;
+
+    itf = g_new0 (DRouteInterface, 1);
+    itf->id = id;
+    itf->name = name;
+    itf->introspect = introspect;
+    itf->methods = g_hash_table_new (g_direct_hash, g_direct_equal);
+    itf->properties = g_hash_table_new_full (g_direct_hash, g_direct_equal,
+                                             NULL, g_free);
+    itf->property_list = g_ptr_array_new ();
+    return itf;
+}
+
+static void
+interface_free (DRouteInterface *itf, gpointer user_data)
+{
+    g_hash_table_destroy (itf->methods);
+    g_hash_table_destroy (itf->properties);
+    g_ptr_array_free (itf->property_list, TRUE);
+    g_free (itf);
+}
+
+static DRouteInterface *
+path_lookup_interface (DRoutePath *path, guint id)
+{
+    return (DRouteInterface *) g_hash_table_lookup (path->interface_ids,
+                                                    GUINT_TO_POINTER (id));
+}
+
+/*---------------------------------------------------------------------------*/
+
 static DRoutePath *
 path_new (DRouteContext *cnx,
           const char *path,
@@ -95,19 +231,8 @@ path_new (DRouteContext *cnx,
     new_path->cnx = cnx;
     new_path->path = g_strdup (path);
     new_path->prefix = prefix;
-    new_path->chunks = g_string_chunk_new (CHUNKS_DEFAULT);
     new_path->interfaces = g_ptr_array_new ();
-    new_path->introspection = g_ptr_array_new ();
-
-    new_path->methods = g_hash_table_new_full ((GHashFunc)str_pair_hash,
-                                               str_pair_equal,
-                                               g_free,
-                                               NULL);
-
-    new_path->properties = g_hash_table_new_full ((GHashFunc)str_pair_hash,
-                                                  str_pair_equal,
-                                                  g_free,
-                                                  g_free);
+    new_path->interface_ids = g_hash_table_new (g_direct_hash, g_direct_equal);
 
     new_path->introspect_children_cb = introspect_children_cb;
     new_path->introspect_children_data = introspect_children_data;
@@ -121,11 +246,10 @@ static void
 path_free (DRoutePath *path, gpointer user_data)
 {
     g_free (path->path);
-    g_string_chunk_free  (path->chunks);
+    g_ptr_array_foreach  (path->interfaces, (GFunc) interface_free, NULL);
     g_ptr_array_free     (path->interfaces, TRUE);
-    g_free(g_ptr_array_free     (path->introspection, FALSE));
-    g_hash_table_destroy (path->methods);
-    g_hash_table_destroy (path->properties);
+    g_hash_table_destroy (path->interface_ids);
+    g_free (path->introspect_xml);
     g_free (path);
 }
 
@@ -148,6 +272,23 @@ droute_new ()
     cnx = g_new0 (DRouteContext, 1);
     cnx->registered_paths = g_ptr_array_new ();
 
+    cnx->chunks = g_string_chunk_new (CHUNKS_DEFAULT);
+    cnx->names = g_hash_table_new (g_str_hash, g_str_equal);
+    cnx->name_list = g_ptr_array_new ();
+    /* Id 0 is never assigned */
+    g_ptr_array_add (cnx->name_list, NULL);
+    cnx->call_stats = g_hash_table_new_full (g_int64_hash, g_int64_equal,
+                                             NULL, g_free);
+
+    cnx->itf_properties = name_intern (cnx, DBUS_INTERFACE_PROPERTIES);
+    cnx->itf_introspectable = name_intern (cnx, DBUS_INTERFACE_INTROSPECTABLE);
+    cnx->itf_multicall = name_intern (cnx, DROUTE_INTERFACE_MULTICALL);
+    cnx->member_get = name_intern (cnx, "Get");
+    cnx->member_set = name_intern (cnx, "Set");
+    cnx->member_get_all = name_intern (cnx, "GetAll");
+    cnx->member_introspect = name_intern (cnx, "Introspect");
+    cnx->member_multicall = name_intern (cnx, "Multicall");
+
     return cnx;
 }
 
@@ -156,6 +297,10 @@ droute_free (DRouteContext *cnx)
 {
     g_ptr_array_foreach (cnx->registered_paths, (GFunc) path_free, NULL);
     g_ptr_array_free (cnx->registered_paths, TRUE);
+    g_hash_table_destroy (cnx->names);
+    g_ptr_array_free (cnx->name_list, TRUE);
+    g_hash_table_destroy (cnx->call_stats);
+    g_string_chunk_free (cnx->chunks);
     g_free (cnx);
 }
 
@@ -210,40 +355,55 @@ droute_path_add_interface(DRoutePath *path,
                           const DRouteMethod   *methods,
                           const DRouteProperty *properties)
 {
-    gchar *itf;
+    DRouteContext *cnx = path->cnx;
+    DRouteInterface *itf;
+    guint id;
 
     g_return_if_fail (name != NULL);
 
-    itf = g_string_chunk_insert (path->chunks, name);
-    g_ptr_array_add (path->interfaces, itf);
-    g_ptr_array_add (path->introspection, (gpointer) introspect);
+    id = name_intern (cnx, name);
+    itf = path_lookup_interface (path, id);
+    if (!itf)
+      {
+        itf = interface_new (id, g_string_chunk_insert_const (cnx->chunks, name),
+                             introspect);
+        g_ptr_array_add (path->interfaces, itf);
+        g_hash_table_insert (path->interface_ids, GUINT_TO_POINTER (id), itf);
+
+        g_free (path->introspect_xml);
+        path->introspect_xml = NULL;
+      }
 
     for (; methods != NULL && methods->name != NULL; methods++)
       {
-        gchar *meth;
+        guint meth;
 
-        meth = g_string_chunk_insert (path->chunks, methods->name);
-        g_hash_table_insert (path->methods, str_pair_new (itf, meth), methods->func);
+        meth = name_intern (cnx, methods->name);
+        g_hash_table_insert (itf->methods, GUINT_TO_POINTER (meth), methods->func);
       }
 
     for (; properties != NULL && properties->name != NULL; properties++)
       {
-        gchar *prop;
+        guint prop;
         PropertyPair *pair;
 
-        prop = g_string_chunk_insert (path->chunks, properties->name);
-        pair = g_new (PropertyPair, 1);
+        prop = name_intern (cnx, properties->name);
+        pair = g_hash_table_lookup (itf->properties, GUINT_TO_POINTER (prop));
+        if (!pair)
+          {
+            pair = g_new (PropertyPair, 1);
+            pair->name = g_string_chunk_insert_const (cnx->chunks, properties->name);
+            g_hash_table_insert (itf->properties, GUINT_TO_POINTER (prop), pair);
+            g_ptr_array_add (itf->property_list, pair);
+          }
         pair->get = properties->get;
         pair->set = properties->set;
-        g_hash_table_insert (path->properties, str_pair_new (itf, prop), pair);
       }
 }
 
 /*---------------------------------------------------------------------------*/
 
-/* The data structures don't support an efficient implementation of GetAll
- * and I don't really care.
- */
+/* Properties are returned in the order they were registered in */
 static DBusMessage *
 impl_prop_GetAll (DBusMessage *message,
                   DRoutePath  *path,
@@ -252,11 +412,10 @@ impl_prop_GetAll (DBusMessage *message,
     DBusMessageIter iter, iter_dict, iter_dict_entry;
     DBusMessage *reply;
     DBusError error;
-    GHashTableIter prop_iter;
 
-    StrPair *key;
-    PropertyPair *value;
     gchar *iface;
+    DRouteInterface *itf;
+    guint i;
 
     void  *datum = path_get_datum (path, pathstr);
     if (!datum)
@@ -281,22 +440,24 @@ impl_prop_GetAll (DBusMessage *message,
                 (&iter, DBUS_TYPE_ARRAY, "{sv}", &iter_dict))
         oom ();
 
-    g_hash_table_iter_init (&prop_iter, path->properties);
-    while (g_hash_table_iter_next (&prop_iter, (gpointer*)&key, (gpointer*)&value))
+    itf = path_lookup_interface (path, name_lookup (path->cnx, iface));
+    if (itf)
       {
-        if (!g_strcmp0 (key->one, iface))
-         {
-           if (!value->get)
-              continue;
-           if (!dbus_message_iter_open_container
-                        (&iter_dict, DBUS_TYPE_DICT_ENTRY, NULL, &iter_dict_entry))
-              oom ();
-           dbus_message_iter_append_basic (&iter_dict_entry, DBUS_TYPE_STRING,
-                                           &key->two);
-           (value->get) (&iter_dict_entry, datum);
-           if (!dbus_message_iter_close_container (&iter_dict, &iter_dict_entry))
+        for (i = 0; i < itf->property_list->len; i++)
+          {
+            PropertyPair *value = g_ptr_array_index (itf->property_list, i);
+
+            if (!value->get)
+               continue;
+            if (!dbus_message_iter_open_container
+                         (&iter_dict, DBUS_TYPE_DICT_ENTRY, NULL, &iter_dict_entry))
                oom ();
-         }
+            dbus_message_iter_append_basic (&iter_dict_entry, DBUS_TYPE_STRING,
+                                            &value->name);
+            (value->get) (&iter_dict_entry, datum);
+            if (!dbus_message_iter_close_container (&iter_dict, &iter_dict_entry))
+                oom ();
+          }
       }
 
     if (!dbus_message_iter_close_container (&iter, &iter_dict))
@@ -313,7 +474,8 @@ impl_prop_GetSet (DBusMessage *message,
     DBusMessage *reply = NULL;
     DBusError error;
 
-    StrPair pair;
+    const gchar *iface, *member;
+    DRouteInterface *itf;
     PropertyPair *prop_funcs = NULL;
 
     void *datum;
@@ -322,19 +484,23 @@ impl_prop_GetSet (DBusMessage *message,
     if (!dbus_message_get_args (message,
                                 &error,
                                 DBUS_TYPE_STRING,
-                                &(pair.one),
+                                &iface,
                                 DBUS_TYPE_STRING,
-                                &(pair.two),
+                                &member,
                                 DBUS_TYPE_INVALID))
       {
         DBusMessage *ret;
         ret = dbus_message_new_error (message, DBUS_ERROR_FAILED, error.message);
         dbus_error_free (&error);
+        return ret;
       }
 
-    _DROUTE_DEBUG ("DRoute (handle prop): %s|%s on %s\n", pair.one, pair.two, pathstr);
+    _DROUTE_DEBUG ("DRoute (handle prop): %s|%s on %s\n", iface, member, pathstr);
 
-    prop_funcs = (PropertyPair *) g_hash_table_lookup (path->properties, &pair);
+    itf = path_lookup_interface (path, name_lookup (path->cnx, iface));
+    if (itf)
+        prop_funcs = (PropertyPair *) g_hash_table_lookup (itf->properties,
+                                                           GUINT_TO_POINTER (name_lookup (path->cnx, member)));
     if (!prop_funcs)
       {
         DBusMessage *ret;
@@ -356,7 +522,7 @@ impl_prop_GetSet (DBusMessage *message,
         
         DBusMessageIter iter;
 
-        _DROUTE_DEBUG ("DRoute (handle prop Get): %s|%s on %s\n", pair.one, pair.two, pathstr);
+        _DROUTE_DEBUG ("DRoute (handle prop Get): %s|%s on %s\n", iface, member, pathstr);
 
         reply = dbus_message_new_method_return (message);
         dbus_message_iter_init_append (reply, &iter);
@@ -370,7 +536,7 @@ impl_prop_GetSet (DBusMessage *message,
       {
         DBusMessageIter iter;
 
-        _DROUTE_DEBUG ("DRoute (handle prop Get): %s|%s on %s\n", pair.one, pair.two, pathstr);
+        _DROUTE_DEBUG ("DRoute (handle prop Get): %s|%s on %s\n", iface, member, pathstr);
 
         dbus_message_iter_init (message, &iter);
         /* Skip the interface and property name */
@@ -424,32 +590,24 @@ handle_dbus (DBusConnection *bus,
 }
 
 static DBusHandlerResult
-handle_properties (DBusConnection *bus,
-                   DBusMessage    *message,
+handle_properties (DBusMessage    *message,
                    DRoutePath     *path,
-                   const gchar    *iface,
-                   const gchar    *member,
-                   const gchar    *pathstr)
+                   guint           member,
+                   const gchar    *pathstr,
+                   DBusMessage   **reply)
 {
-    DBusMessage *reply = NULL;
-    DBusHandlerResult result = DBUS_HANDLER_RESULT_HANDLED;
-
-    if (!g_strcmp0(member, "GetAll"))
-       reply = impl_prop_GetAll (message, path, pathstr);
-    else if (!g_strcmp0 (member, "Get"))
-       reply = impl_prop_GetSet (message, path, pathstr, TRUE);
-    else if (!g_strcmp0 (member, "Set"))
-       reply = impl_prop_GetSet (message, path, pathstr, FALSE);
+    DRouteContext *cnx = path->cnx;
+
+    if (member == cnx->member_get_all)
+       *reply = impl_prop_GetAll (message, path, pathstr);
+    else if (member == cnx->member_get)
+       *reply = impl_prop_GetSet (message, path, pathstr, TRUE);
+    else if (member == cnx->member_set)
+       *reply = impl_prop_GetSet (message, path, pathstr, FALSE);
     else
-       result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-
-    if (reply)
-      {
-        dbus_connection_send (bus, reply, NULL);
-        dbus_message_unref (reply);
-      }
+       return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-    return result;
+    return DBUS_HANDLER_RESULT_HANDLED;
 }
 
 /*---------------------------------------------------------------------------*/
@@ -463,60 +621,87 @@ static const char *introspection_node_element =
 static const char *introspection_footer =
 "</node>";
 
+static const char *introspection_multicall =
+"<interface name=\"" DROUTE_INTERFACE_MULTICALL "\">"
+"  <method name=\"Multicall\">"
+"    <arg direction=\"in\" name=\"calls\" type=\"a(ossav)\" />"
+"    <arg direction=\"out\" name=\"replies\" type=\"a(sav)\" />"
+"  </method>"
+"</interface>";
+
+static const gchar *
+path_get_introspect_xml (DRoutePath *path)
+{
+    GString *xml;
+    gint i;
+
+    if (path->introspect_xml)
+        return path->introspect_xml;
+
+    xml = g_string_new ("");
+    for (i=0; i < path->interfaces->len; i++)
+      {
+        DRouteInterface *itf = g_ptr_array_index (path->interfaces, i);
+        if (itf->introspect)
+            g_string_append (xml, itf->introspect);
+      }
+    g_string_append (xml, introspection_multicall);
+
+    path->introspect_xml_len = xml->len;
+    path->introspect_xml = g_string_free (xml, FALSE);
+    return path->introspect_xml;
+}
+
 static DBusHandlerResult
-handle_introspection (DBusConnection *bus,
-                      DBusMessage    *message,
+handle_introspection (DBusMessage    *message,
                       DRoutePath     *path,
-                      const gchar    *iface,
-                      const gchar    *member,
-                      const gchar    *pathstr)
+                      guint           member,
+                      const gchar    *pathstr,
+                      DBusMessage   **reply)
 {
     GString *output;
-    gchar *final;
-    gint i;
-
-    DBusMessage *reply;
+    gchar *children = NULL;
+    const gchar *interfaces = NULL;
+    gsize len;
 
     _DROUTE_DEBUG ("DRoute (handle introspection): %s\n", pathstr);
 
-    if (g_strcmp0 (member, "Introspect"))
+    if (member != path->cnx->member_introspect)
         return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 
-    output = g_string_new(introspection_header);
-
-    g_string_append_printf(output, introspection_node_element, pathstr);
-
     if (!path->get_datum || path_get_datum (path, pathstr))
-      {
-        for (i=0; i < path->introspection->len; i++)
-          {
-            gchar *introspect = (gchar *) g_ptr_array_index (path->introspection, i);
-            g_string_append (output, introspect);
-          }
-      }
+        interfaces = path_get_introspect_xml (path);
 
     if (path->introspect_children_cb)
+        children = (*path->introspect_children_cb) (pathstr, path->introspect_children_data);
+
+    /* Size the buffer up front so the document is built without regrowing */
+    len = strlen (introspection_header) + strlen (introspection_node_element) +
+          strlen (pathstr) + strlen (introspection_footer) + 1;
+    if (interfaces)
+        len += path->introspect_xml_len;
+    if (children)
+        len += strlen (children);
+
+    output = g_string_sized_new (len);
+    g_string_append (output, introspection_header);
+    g_string_append_printf (output, introspection_node_element, pathstr);
+    if (interfaces)
+        g_string_append_len (output, interfaces, path->introspect_xml_len);
+    if (children)
       {
-        gchar *children = (*path->introspect_children_cb) (pathstr, path->introspect_children_data);
-        if (children)
-          {
-            g_string_append (output, children);
-            g_free (children);
-          }
+        g_string_append (output, children);
+        g_free (children);
       }
+    g_string_append (output, introspection_footer);
 
-    g_string_append(output, introspection_footer);
-    final = g_string_free(output, FALSE);
-
-    reply = dbus_message_new_method_return (message);
-    if (!reply)
+    *reply = dbus_message_new_method_return (message);
+    if (!*reply)
         oom ();
-    dbus_message_append_args(reply, DBUS_TYPE_STRING, &final,
+    dbus_message_append_args(*reply, DBUS_TYPE_STRING, &output->str,
                              DBUS_TYPE_INVALID);
-    dbus_connection_send (bus, reply, NULL);
 
-    dbus_message_unref (reply);
-    g_free(final);
+    g_string_free (output, TRUE);
     return DBUS_HANDLER_RESULT_HANDLED;
 }
 
@@ -526,51 +711,401 @@ static DBusHandlerResult
 handle_other (DBusConnection *bus,
               DBusMessage    *message,
               DRoutePath     *path,
-              const gchar    *iface,
-              const gchar    *member,
-              const gchar    *pathstr)
+              guint           iface,
+              guint           member,
+              const gchar    *pathstr,
+              DBusMessage   **reply)
 {
-    gint result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
-
-    StrPair pair;
-    DRouteFunction func;
-    DBusMessage *reply = NULL;
+    DRouteInterface *itf;
+    DRouteFunction func = NULL;
 
     void *datum;
 
-    pair.one = iface;
-    pair.two = member;
+    _DROUTE_DEBUG ("DRoute (handle other): %s|%s on %s\n",
+                   dbus_message_get_member (message),
+                   dbus_message_get_interface (message), pathstr);
+
+    itf = path_lookup_interface (path, iface);
+    if (itf)
+        func = (DRouteFunction) g_hash_table_lookup (itf->methods,
+                                                     GUINT_TO_POINTER (member));
+    if (func == NULL)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    datum = path_get_datum (path, pathstr);
+    if (!datum)
+        *reply = droute_object_does_not_exist_error (message);
+    else
+        *reply = (func) (bus, message, datum);
+
+    return DBUS_HANDLER_RESULT_HANDLED;
+}
+
+/*---------------------------------------------------------------------------*/
 
-    _DROUTE_DEBUG ("DRoute (handle other): %s|%s on %s\n", member, iface, pathstr);
+/*
+ * Multicall runs a batch of method calls in one main loop dispatch.
+ *
+ * Each call is given as (path, interface, member, args) where args holds
+ * one variant per argument. Each result is returned in order as
+ * (error name, args); the error name is empty on success, and for errors
+ * args holds the error message.
+ */
 
-    func = (DRouteFunction) g_hash_table_lookup (path->methods, &pair);
-    if (func != NULL)
+static void
+copy_value (DBusMessageIter *from, DBusMessageIter *to)
+{
+    int type = dbus_message_iter_get_arg_type (from);
+
+    if (dbus_type_is_basic (type))
       {
-        datum = path_get_datum (path, pathstr);
-        if (!datum)
-	    reply = droute_object_does_not_exist_error (message);
+        DBusBasicValue value;
+
+        dbus_message_iter_get_basic (from, &value);
+        dbus_message_iter_append_basic (to, type, &value);
+      }
+    else
+      {
+        DBusMessageIter from_sub, to_sub;
+        char *signature = NULL;
+
+        dbus_message_iter_recurse (from, &from_sub);
+        if (type == DBUS_TYPE_VARIANT)
+            signature = dbus_message_iter_get_signature (&from_sub);
+        else if (type == DBUS_TYPE_ARRAY)
+          {
+            char *full = dbus_message_iter_get_signature (from);
+            signature = g_strdup (full + 1);
+            dbus_free (full);
+          }
+
+        if (!dbus_message_iter_open_container (to, type, signature, &to_sub))
+            oom ();
+        while (dbus_message_iter_get_arg_type (&from_sub) != DBUS_TYPE_INVALID)
+          {
+            copy_value (&from_sub, &to_sub);
+            dbus_message_iter_next (&from_sub);
+          }
+        if (!dbus_message_iter_close_container (to, &to_sub))
+            oom ();
+
+        if (type == DBUS_TYPE_VARIANT)
+            dbus_free (signature);
         else
-            reply = (func) (bus, message, datum);
+            g_free (signature);
+      }
+}
 
-        /* All D-Bus method calls must have a reply.
-         * If one is not provided presume that the caller has already
-         * sent one.
-         */
-        if (reply)
+static DRoutePath *
+context_find_path (DRouteContext *cnx, const char *pathstr)
+{
+    DRoutePath *found = NULL;
+    gsize found_len = 0;
+    gint i;
+
+    for (i = 0; i < cnx->registered_paths->len; i++)
+      {
+        DRoutePath *path = g_ptr_array_index (cnx->registered_paths, i);
+        gsize len = strlen (path->path);
+
+        if (strncmp (pathstr, path->path, len) != 0)
+            continue;
+        if (pathstr[len] != '\0' &&
+            !(path->prefix && (pathstr[len] == '/' || path->path[len - 1] == '/')))
+            continue;
+        if (!found || len > found_len)
           {
-            dbus_connection_send (bus, reply, NULL);
-            dbus_message_unref (reply);
+            found = path;
+            found_len = len;
           }
-        result = DBUS_HANDLER_RESULT_HANDLED;
       }
+    return found;
+}
 
-    _DROUTE_DEBUG ("DRoute (handle other) (reply): type %d\n",
-                   dbus_message_get_type(reply));
-    return result;
+static DBusMessage *
+multicall_make_call (DBusMessage *message, DBusMessageIter *iter_call)
+{
+    DBusMessage *call;
+    DBusMessageIter iter, iter_args;
+    const char *pathstr, *iface, *member;
+
+    dbus_message_iter_get_basic (iter_call, &pathstr);
+    dbus_message_iter_next (iter_call);
+    dbus_message_iter_get_basic (iter_call, &iface);
+    dbus_message_iter_next (iter_call);
+    dbus_message_iter_get_basic (iter_call, &member);
+    dbus_message_iter_next (iter_call);
+
+    /* libdbus aborts on malformed names rather than failing the call */
+    if (!dbus_validate_path (pathstr, NULL) ||
+        !dbus_validate_interface (iface, NULL) ||
+        !dbus_validate_member (member, NULL))
+        return NULL;
+
+    call = dbus_message_new_method_call (NULL, pathstr, iface, member);
+    if (!call)
+        return NULL;
+
+    /*
+     * Handlers may look at the sender. A handler that sends its own reply
+     * sends it to a serial the caller never used, so it is ignored there.
+     */
+    dbus_message_set_sender (call, dbus_message_get_sender (message));
+    dbus_message_set_serial (call, G_MAXUINT32);
+
+    dbus_message_iter_init_append (call, &iter);
+    dbus_message_iter_recurse (iter_call, &iter_args);
+    while (dbus_message_iter_get_arg_type (&iter_args) != DBUS_TYPE_INVALID)
+      {
+        DBusMessageIter iter_variant;
+
+        dbus_message_iter_recurse (&iter_args, &iter_variant);
+        copy_value (&iter_variant, &iter);
+        dbus_message_iter_next (&iter_args);
+      }
+    return call;
+}
+
+static void
+multicall_append_reply (DBusMessageIter *iter_array, DBusMessage *reply)
+{
+    DBusMessageIter iter_struct, iter_args, iter_variant, iter;
+    const char *error_name = "";
+
+    if (reply && dbus_message_get_type (reply) == DBUS_MESSAGE_TYPE_ERROR)
+        error_name = dbus_message_get_error_name (reply);
+
+    if (!dbus_message_iter_open_container (iter_array, DBUS_TYPE_STRUCT, NULL,
+                                           &iter_struct))
+        oom ();
+    dbus_message_iter_append_basic (&iter_struct, DBUS_TYPE_STRING, &error_name);
+    if (!dbus_message_iter_open_container (&iter_struct, DBUS_TYPE_ARRAY, "v",
+                                           &iter_args))
+        oom ();
+    if (reply && dbus_message_iter_init (reply, &iter))
+      {
+        do
+          {
+            char *signature = dbus_message_iter_get_signature (&iter);
+
+            if (!dbus_message_iter_open_container (&iter_args, DBUS_TYPE_VARIANT,
+                                                   signature, &iter_variant))
+                oom ();
+            copy_value (&iter, &iter_variant);
+            if (!dbus_message_iter_close_container (&iter_args, &iter_variant))
+                oom ();
+            dbus_free (signature);
+          }
+        while (dbus_message_iter_next (&iter));
+      }
+    if (!dbus_message_iter_close_container (&iter_struct, &iter_args))
+        oom ();
+    if (!dbus_message_iter_close_container (iter_array, &iter_struct))
+        oom ();
+}
+
+static DBusHandlerResult
+handle_multicall (DBusConnection *bus,
+                  DBusMessage    *message,
+                  DRoutePath     *path,
+                  guint           member,
+                  DBusMessage   **reply)
+{
+    DRouteContext *cnx = path->cnx;
+    DBusMessageIter iter, iter_array, iter_call, iter_reply, iter_replies;
+
+    if (member != cnx->member_multicall)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    if (strcmp (dbus_message_get_signature (message), "a(ossav)") != 0)
+      {
+        *reply = droute_invalid_arguments_error (message);
+        return DBUS_HANDLER_RESULT_HANDLED;
+      }
+
+    *reply = dbus_message_new_method_return (message);
+    if (!*reply)
+        oom ();
+    dbus_message_iter_init_append (*reply, &iter_reply);
+    if (!dbus_message_iter_open_container (&iter_reply, DBUS_TYPE_ARRAY, "(sav)",
+                                           &iter_replies))
+        oom ();
+
+    dbus_message_iter_init (message, &iter);
+    dbus_message_iter_recurse (&iter, &iter_array);
+    while (dbus_message_iter_get_arg_type (&iter_array) != DBUS_TYPE_INVALID)
+      {
+        DBusMessage *call, *call_reply = NULL;
+        DRoutePath *call_path;
+        DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+        dbus_message_iter_recurse (&iter_array, &iter_call);
+        call = multicall_make_call (message, &iter_call);
+
+        if (call)
+          {
+            call_path = context_find_path (cnx, dbus_message_get_path (call));
+            /* Nested batches are not run */
+            if (call_path &&
+                name_lookup (cnx, dbus_message_get_interface (call)) != cnx->itf_multicall)
+                result = droute_path_dispatch (call_path, bus, call, &call_reply);
+            if (result == DBUS_HANDLER_RESULT_NOT_YET_HANDLED)
+                call_reply = droute_not_yet_handled_error (call);
+          }
+        else
+            call_reply = droute_invalid_arguments_error (message);
+
+        /* A handler that sent its own reply is reported as succeeding */
+        multicall_append_reply (&iter_replies, call_reply);
+
+        if (call_reply)
+            dbus_message_unref (call_reply);
+        if (call)
+            dbus_message_unref (call);
+        dbus_message_iter_next (&iter_array);
+      }
+
+    if (!dbus_message_iter_close_container (&iter_reply, &iter_replies))
+        oom ();
+    return DBUS_HANDLER_RESULT_HANDLED;
 }
 
 /*---------------------------------------------------------------------------*/
 
+/*
+ * Counts a handled call. Calls made inside a Multicall batch are counted
+ * against their own interface and member as well as against the batch.
+ */
+static void
+record_call (DRouteContext *cnx, guint iface, guint member, gint64 time_us)
+{
+    guint64 key = CALL_STATS_KEY (iface, member);
+    DRouteCallStats *stats;
+
+    stats = g_hash_table_lookup (cnx->call_stats, &key);
+    if (!stats)
+      {
+        stats = g_new0 (DRouteCallStats, 1);
+        stats->key = key;
+        g_hash_table_insert (cnx->call_stats, &stats->key, stats);
+      }
+    stats->calls++;
+    stats->time_us += MAX (time_us, 0);
+}
+
+void
+droute_context_foreach_call_stats (DRouteContext            *cnx,
+                                   DRouteCallStatsFunction   func,
+                                   void                     *user_data)
+{
+    GHashTableIter iter;
+    DRouteCallStats *stats;
+
+    g_hash_table_iter_init (&iter, cnx->call_stats);
+    while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+        func (g_ptr_array_index (cnx->name_list, stats->key >> 32),
+              g_ptr_array_index (cnx->name_list, stats->key & G_MAXUINT32),
+              stats->calls, stats->time_us, user_data);
+}
+
+/*
+ * Sets whether the size of each reply is added to the bytes sent.
+ * Measuring a message means marshalling it, so this is off by default.
+ */
+void
+droute_context_set_count_bytes (DRouteContext *cnx, gboolean count_bytes)
+{
+    cnx->count_bytes = count_bytes;
+}
+
+guint64
+droute_context_get_bytes_sent (DRouteContext *cnx)
+{
+    return cnx->bytes_sent;
+}
+
+/*
+ * Returns the number of bytes the message takes up on the wire.
+ * libdbus doesn't expose the length of a message, so this marshals a
+ * copy of it; only call it when the size is actually wanted.
+ */
+gsize
+droute_message_size (DBusMessage *message)
+{
+    char *data;
+    int len;
+
+    if (!dbus_message_marshal (message, &data, &len))
+        return 0;
+    dbus_free (data);
+    return len;
+}
+
+/*
+ * Sets a function to be told how long each handled call took, named after
+ * its member with its interface as the category, and how long handling
+ * each incoming message took as a whole, including sending the reply.
+ */
+void
+droute_context_set_span_func (DRouteContext      *cnx,
+                              DRouteSpanFunction  func,
+                              void               *user_data)
+{
+    cnx->span_func = func;
+    cnx->span_data = user_data;
+}
+
+/*---------------------------------------------------------------------------*/
+
+DBusHandlerResult
+droute_path_dispatch (DRoutePath     *path,
+                      DBusConnection *bus,
+                      DBusMessage    *message,
+                      DBusMessage   **reply)
+{
+    DRouteContext *cnx = path->cnx;
+    const gchar *pathstr = dbus_message_get_path (message);
+    DBusHandlerResult result;
+    guint iface, member;
+    gint64 start;
+
+    *reply = NULL;
+
+    /* Names that were never registered can't be routed anywhere */
+    iface = name_lookup (cnx, dbus_message_get_interface (message));
+    member = name_lookup (cnx, dbus_message_get_member (message));
+    if (!iface || !member)
+        return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+
+    _DROUTE_PROBE3 (method_entry, g_ptr_array_index (cnx->name_list, iface),
+                    g_ptr_array_index (cnx->name_list, member), pathstr);
+    start = g_get_monotonic_time ();
+
+    if (iface == cnx->itf_properties)
+        result = handle_properties (message, path, member, pathstr, reply);
+    else if (iface == cnx->itf_introspectable)
+        result = handle_introspection (message, path, member, pathstr, reply);
+    else if (iface == cnx->itf_multicall)
+        result = handle_multicall (bus, message, path, member, reply);
+    else
+        result = handle_other (bus, message, path, iface, member, pathstr, reply);
+
+    if (result == DBUS_HANDLER_RESULT_HANDLED)
+      {
+        gint64 end = g_get_monotonic_time ();
+
+        record_call (cnx, iface, member, end - start);
+        if (cnx->span_func)
+            cnx->span_func (g_ptr_array_index (cnx->name_list, member),
+                            g_ptr_array_index (cnx->name_list, iface),
+                            start, end, cnx->span_data);
+      }
+    _DROUTE_PROBE4 (method_return, g_ptr_array_index (cnx->name_list, iface),
+                    g_ptr_array_index (cnx->name_list, member), pathstr,
+                    result == DBUS_HANDLER_RESULT_HANDLED);
+    return result;
+}
+
 static DBusHandlerResult
 handle_message (DBusConnection *bus, DBusMessage *message, void *user_data)
 {
@@ -581,6 +1116,8 @@ handle_message (DBusConnection *bus, DBusMessage *message, void *user_data)
     const gchar *pathstr = dbus_message_get_path (message);
 
     DBusHandlerResult result = DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
+    DBusMessage *reply = NULL;
+    gint64 start = 0;
 
     _DROUTE_DEBUG ("DRoute (handle message): %s|%s of type %d on %s\n", member, iface, type, pathstr);
 
@@ -591,13 +1128,27 @@ handle_message (DBusConnection *bus, DBusMessage *message, void *user_data)
         return result;
 
     if (!strcmp (pathstr, DBUS_PATH_DBUS))
-        result = handle_dbus (bus, message, iface, member, pathstr);
-    else if (!strcmp (iface, "org.freedesktop.DBus.Properties"))
-        result = handle_properties (bus, message, path, iface, member, pathstr);
-    else if (!strcmp (iface, "org.freedesktop.DBus.Introspectable"))
-        result = handle_introspection (bus, message, path, iface, member, pathstr);
-    else
-        result = handle_other (bus, message, path, iface, member, pathstr);
+        return handle_dbus (bus, message, iface, member, pathstr);
+
+    if (path->cnx->span_func)
+        start = g_get_monotonic_time ();
+
+    result = droute_path_dispatch (path, bus, message, &reply);
+
+    /* All D-Bus method calls must have a reply.
+     * If one is not provided presume that the caller has already
+     * sent one.
+     */
+    if (reply)
+      {
+        if (dbus_connection_send (bus, reply, NULL) && path->cnx->count_bytes)
+            path->cnx->bytes_sent += droute_message_size (reply);
+        dbus_message_unref (reply);
+      }
+
+    if (start)
+        path->cnx->span_func ("handle_message", "droute", start,
+                              g_get_monotonic_time (), path->cnx->span_data);
 #if 0
     if (result == DBUS_HANDLER_RESULT_NOT_YET_HANDLED)
         g_print ("DRoute | Unhandled message: %s|%s of type %d on %s\n", member, iface, type, pathstr);
@@ -28,6 +28,8 @@
 
 #include <droute/droute-variant.h>
 
+#define DROUTE_INTERFACE_MULTICALL "org.a11y.atspi.Multicall"
+
 
 typedef DBusMessage *(*DRouteFunction)         (DBusConnection *, DBusMessage *, void *);
 typedef dbus_bool_t  (*DRoutePropertyFunction) (DBusMessageIter *, void *);
@@ -35,6 +37,18 @@ typedef gchar *(*DRouteIntrospectChildrenFunction) (const char *, void *);
 
 typedef void        *(*DRouteGetDatumFunction) (const char *, void *);
 
+typedef void         (*DRouteCallStatsFunction) (const char *interface,
+                                                 const char *member,
+                                                 guint64     calls,
+                                                 guint64     time_us,
+                                                 void       *user_data);
+
+typedef void         (*DRouteSpanFunction)      (const char *name,
+                                                 const char *category,
+                                                 gint64      start_us,
+                                                 gint64      end_us,
+                                                 void       *user_data);
+
 typedef struct _DRouteMethod DRouteMethod;
 struct _DRouteMethod
 {
@@ -84,6 +98,12 @@ droute_path_add_interface (DRoutePath *path,
                            const DRouteMethod   *methods,
                            const DRouteProperty *properties);
 
+DBusHandlerResult
+droute_path_dispatch      (DRoutePath     *path,
+                           DBusConnection *bus,
+                           DBusMessage    *message,
+                           DBusMessage   **reply);
+
 DBusMessage *
 droute_not_yet_handled_error   (DBusMessage *message);
 
@@ -105,6 +125,25 @@ droute_context_register (DRouteContext *cnx, DBusConnection *bus);
 void
 droute_context_unregister (DRouteContext *cnx, DBusConnection *bus);
 
+void
+droute_context_foreach_call_stats (DRouteContext           *cnx,
+                                   DRouteCallStatsFunction  func,
+                                   void                    *user_data);
+
+void
+droute_context_set_count_bytes (DRouteContext *cnx, gboolean count_bytes);
+
+guint64
+droute_context_get_bytes_sent (DRouteContext *cnx);
+
+gsize
+droute_message_size (DBusMessage *message);
+
+void
+droute_context_set_span_func (DRouteContext      *cnx,
+                              DRouteSpanFunction  func,
+                              void               *user_data);
+
 void
 droute_intercept_dbus (DBusConnection *connection);
 
@@ -27,6 +27,7 @@
 
 #define ATK_TEST_PATH_ACCESSIBLE (const char *)"/Accessible"
 #define ATK_TEST_PATH_ACTION (const char *)"/Action"
+#define ATK_TEST_PATH_CACHE (const char *)"/Cache"
 #define ATK_TEST_PATH_COMP (const char *)"/Component"
 #define ATK_TEST_PATH_COLLECTION (const char *)"/Collection"
 #define ATK_TEST_PATH_DOC (const char *)"/Document"
@@ -43,6 +44,7 @@
 
 void atk_test_accessible (void);
 void atk_test_action (void);
+void atk_test_cache (void);
 void atk_test_component (void);
 void atk_test_collection (void);
 void atk_test_document (void);
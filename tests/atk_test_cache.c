@@ -0,0 +1,327 @@
+/*
+ * AT-SPI - Assistive Technology Service Provider Interface
+ * (Gnome Accessibility Project; https://wiki.gnome.org/Accessibility)
+ *
+ * Copyright (c) 2015 Samsung Electronics Co., Ltd.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Library General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Library General Public License for more details.
+ *
+ * You should have received a copy of the GNU Library General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 59 Temple Place - Suite 330,
+ * Boston, MA 02111-1307, USA.
+ */
+
+#include <stdarg.h>
+#include "atk_suite.h"
+#include "atk_test_util.h"
+
+#define DATA_FILE TESTS_DATA_DIR"/test-accessible.xml"
+
+#define CACHE_PATH "/org/a11y/atspi/cache"
+#define STALE_PATH "/org/a11y/atspi/accessible/999999"
+
+/*
+ * GetItemsPaged and GetProperties have no wrappers in libatspi, so these
+ * tests call the application's cache directly.
+ */
+
+static void
+teardown_cache_test (gpointer fixture, gconstpointer user_data)
+{
+  kill (child_pid, SIGTERM);
+}
+
+static DBusMessage *
+call_cache (DBusConnection *bus, AtspiAccessible *obj, const char *method,
+            int first_arg_type, ...)
+{
+  DBusMessage *message, *reply;
+  va_list args;
+
+  message = dbus_message_new_method_call (ATSPI_OBJECT (obj)->app->bus_name,
+                                          CACHE_PATH,
+                                          ATSPI_DBUS_INTERFACE_CACHE,
+                                          method);
+  va_start (args, first_arg_type);
+  dbus_message_append_args_valist (message, first_arg_type, args);
+  va_end (args);
+
+  reply = dbus_connection_send_with_reply_and_block (bus, message, -1, NULL);
+  dbus_message_unref (message);
+  g_assert (reply);
+  return reply;
+}
+
+static DBusMessage *
+get_items_paged (DBusConnection *bus, AtspiAccessible *obj,
+                 dbus_uint32_t cursor, dbus_uint32_t count)
+{
+  return call_cache (bus, obj, "GetItemsPaged",
+                     DBUS_TYPE_UINT32, &cursor,
+                     DBUS_TYPE_UINT32, &count,
+                     DBUS_TYPE_INVALID);
+}
+
+/* Adds the path of each item in a reply to paths, returning how many */
+static gint
+collect_item_paths (DBusMessage *reply, GHashTable *paths)
+{
+  DBusMessageIter iter, iter_array, iter_item, iter_ref;
+  const char *path;
+  gint n = 0;
+
+  dbus_message_iter_init (reply, &iter);
+  dbus_message_iter_recurse (&iter, &iter_array);
+  while (dbus_message_iter_get_arg_type (&iter_array) != DBUS_TYPE_INVALID)
+  {
+    dbus_message_iter_recurse (&iter_array, &iter_item);
+    dbus_message_iter_recurse (&iter_item, &iter_ref);
+    dbus_message_iter_next (&iter_ref);
+    dbus_message_iter_get_basic (&iter_ref, &path);
+    if (paths)
+      g_hash_table_add (paths, g_strdup (path));
+    n++;
+    dbus_message_iter_next (&iter_array);
+  }
+  return n;
+}
+
+static dbus_uint32_t
+get_next_cursor (DBusMessage *reply)
+{
+  DBusMessageIter iter;
+  dbus_uint32_t cursor;
+
+  dbus_message_iter_init (reply, &iter);
+  dbus_message_iter_next (&iter);
+  dbus_message_iter_get_basic (&iter, &cursor);
+  return cursor;
+}
+
+/* Opens a second connection to the accessibility bus, with its own name */
+static DBusConnection *
+open_other_connection (void)
+{
+  const char *address = g_getenv ("AT_SPI_BUS_ADDRESS");
+  DBusMessage *reply = NULL;
+  DBusConnection *bus;
+
+  if (!address)
+  {
+    DBusConnection *session = dbus_bus_get (DBUS_BUS_SESSION, NULL);
+    DBusMessage *message;
+
+    g_assert (session);
+    message = dbus_message_new_method_call ("org.a11y.Bus", "/org/a11y/bus",
+                                            "org.a11y.Bus", "GetAddress");
+    reply = dbus_connection_send_with_reply_and_block (session, message,
+                                                       -1, NULL);
+    dbus_message_unref (message);
+    g_assert (reply);
+    g_assert (dbus_message_get_args (reply, NULL, DBUS_TYPE_STRING, &address,
+                                     DBUS_TYPE_INVALID));
+  }
+
+  bus = dbus_connection_open_private (address, NULL);
+  g_assert (bus);
+  g_assert (dbus_bus_register (bus, NULL));
+  if (reply)
+    dbus_message_unref (reply);
+  return bus;
+}
+
+static void
+atk_test_cache_get_items_paged (gpointer fixture, gconstpointer user_data)
+{
+  AtspiAccessible *obj = get_root_obj (DATA_FILE);
+  DBusConnection *bus = atspi_get_a11y_bus ();
+  GHashTable *paths = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                             g_free, NULL);
+  DBusMessage *reply;
+  dbus_uint32_t cursor = 0;
+  gint n_items, n_pages = 0, n_paged = 0;
+
+  reply = call_cache (bus, obj, "GetItems", DBUS_TYPE_INVALID);
+  n_items = collect_item_paths (reply, NULL);
+  dbus_message_unref (reply);
+  g_assert_cmpint (n_items, >, 3);
+
+  do {
+    gint n;
+
+    reply = get_items_paged (bus, obj, cursor, 3);
+    g_assert_cmpint (dbus_message_get_type (reply), ==,
+                     DBUS_MESSAGE_TYPE_METHOD_RETURN);
+    n = collect_item_paths (reply, paths);
+    cursor = get_next_cursor (reply);
+    dbus_message_unref (reply);
+
+    g_assert_cmpint (n, <=, 3);
+    if (cursor)
+      g_assert_cmpint (n, ==, 3);
+    n_paged += n;
+    n_pages++;
+  } while (cursor);
+
+  g_assert_cmpint (n_pages, ==, (n_items + 2) / 3);
+  g_assert_cmpint (n_paged, ==, n_items);
+  g_assert_cmpint (g_hash_table_size (paths), ==, n_items);
+  g_hash_table_unref (paths);
+}
+
+static void
+atk_test_cache_get_items_paged_unknown_cursor (gpointer fixture, gconstpointer user_data)
+{
+  AtspiAccessible *obj = get_root_obj (DATA_FILE);
+  DBusConnection *bus = atspi_get_a11y_bus ();
+  DBusMessage *reply;
+
+  reply = get_items_paged (bus, obj, 12345, 3);
+  g_assert_cmpstr (dbus_message_get_error_name (reply), ==,
+                   DBUS_ERROR_INVALID_ARGS);
+  dbus_message_unref (reply);
+}
+
+static void
+atk_test_cache_get_items_paged_other_sender (gpointer fixture, gconstpointer user_data)
+{
+  AtspiAccessible *obj = get_root_obj (DATA_FILE);
+  DBusConnection *bus = atspi_get_a11y_bus ();
+  DBusConnection *other = open_other_connection ();
+  DBusMessage *reply;
+  dbus_uint32_t cursor;
+
+  reply = get_items_paged (bus, obj, 0, 1);
+  cursor = get_next_cursor (reply);
+  dbus_message_unref (reply);
+  g_assert_cmpuint (cursor, !=, 0);
+
+  /* Another client can't continue this client's export */
+  reply = get_items_paged (other, obj, cursor, 1);
+  g_assert_cmpstr (dbus_message_get_error_name (reply), ==,
+                   DBUS_ERROR_INVALID_ARGS);
+  dbus_message_unref (reply);
+
+  /* ... nor does starting its own export replace it */
+  reply = get_items_paged (other, obj, 0, 1);
+  g_assert_cmpint (dbus_message_get_type (reply), ==,
+                   DBUS_MESSAGE_TYPE_METHOD_RETURN);
+  dbus_message_unref (reply);
+
+  reply = get_items_paged (bus, obj, cursor, 1);
+  g_assert_cmpint (dbus_message_get_type (reply), ==,
+                   DBUS_MESSAGE_TYPE_METHOD_RETURN);
+  dbus_message_unref (reply);
+
+  dbus_connection_close (other);
+  dbus_connection_unref (other);
+}
+
+static void
+atk_test_cache_get_items_paged_restart (gpointer fixture, gconstpointer user_data)
+{
+  AtspiAccessible *obj = get_root_obj (DATA_FILE);
+  DBusConnection *bus = atspi_get_a11y_bus ();
+  DBusMessage *reply;
+  dbus_uint32_t cursor;
+
+  reply = get_items_paged (bus, obj, 0, 1);
+  cursor = get_next_cursor (reply);
+  dbus_message_unref (reply);
+  g_assert_cmpuint (cursor, !=, 0);
+
+  /* Starting a new export drops the client's unfinished one */
+  reply = get_items_paged (bus, obj, 0, 1);
+  dbus_message_unref (reply);
+
+  reply = get_items_paged (bus, obj, cursor, 1);
+  g_assert_cmpstr (dbus_message_get_error_name (reply), ==,
+                   DBUS_ERROR_INVALID_ARGS);
+  dbus_message_unref (reply);
+}
+
+static void
+atk_test_cache_get_properties (gpointer fixture, gconstpointer user_data)
+{
+  AtspiAccessible *obj = get_root_obj (DATA_FILE);
+  AtspiAccessible *child = atspi_accessible_get_child_at_index (obj, 0, NULL);
+  DBusConnection *bus = atspi_get_a11y_bus ();
+  const char *paths[] = { ATSPI_OBJECT (obj)->path, STALE_PATH,
+                          ATSPI_OBJECT (child)->path };
+  const char *names[] = { "Name", "text.CharacterCount", "NoSuchProperty" };
+  const char *expected_names[] = { "root_object", NULL, "obj1" };
+  const char **paths_p = paths, **names_p = names;
+  DBusMessageIter iter, iter_array, iter_struct, iter_dict;
+  DBusMessage *reply;
+  gint i;
+
+  reply = call_cache (bus, obj, "GetProperties",
+                      DBUS_TYPE_ARRAY, DBUS_TYPE_OBJECT_PATH, &paths_p, 3,
+                      DBUS_TYPE_ARRAY, DBUS_TYPE_STRING, &names_p, 3,
+                      DBUS_TYPE_INVALID);
+  g_assert_cmpstr (dbus_message_get_signature (reply), ==, "a(oa{sv})");
+
+  dbus_message_iter_init (reply, &iter);
+  dbus_message_iter_recurse (&iter, &iter_array);
+  for (i = 0; i < 3; i++) {
+    const char *path;
+
+    /* Each path gets an entry, in order, even if it can't be resolved */
+    g_assert_cmpint (dbus_message_iter_get_arg_type (&iter_array), ==,
+                     DBUS_TYPE_STRUCT);
+    dbus_message_iter_recurse (&iter_array, &iter_struct);
+    dbus_message_iter_get_basic (&iter_struct, &path);
+    g_assert_cmpstr (path, ==, paths[i]);
+    dbus_message_iter_next (&iter_struct);
+    dbus_message_iter_recurse (&iter_struct, &iter_dict);
+
+    /*
+     * Only Name applies: the objects don't implement Text, and unknown
+     * properties are left out
+     */
+    if (expected_names[i]) {
+      DBusMessageIter iter_entry, iter_variant;
+      const char *name, *value;
+
+      dbus_message_iter_recurse (&iter_dict, &iter_entry);
+      dbus_message_iter_get_basic (&iter_entry, &name);
+      g_assert_cmpstr (name, ==, "Name");
+      dbus_message_iter_next (&iter_entry);
+      dbus_message_iter_recurse (&iter_entry, &iter_variant);
+      dbus_message_iter_get_basic (&iter_variant, &value);
+      g_assert_cmpstr (value, ==, expected_names[i]);
+      dbus_message_iter_next (&iter_dict);
+    }
+    g_assert_cmpint (dbus_message_iter_get_arg_type (&iter_dict), ==,
+                     DBUS_TYPE_INVALID);
+
+    dbus_message_iter_next (&iter_array);
+  }
+  g_assert_cmpint (dbus_message_iter_get_arg_type (&iter_array), ==,
+                   DBUS_TYPE_INVALID);
+  dbus_message_unref (reply);
+}
+
+void
+atk_test_cache (void)
+{
+  g_test_add_vtable (ATK_TEST_PATH_CACHE "/atk_test_cache_get_items_paged",
+                     0, NULL, NULL, atk_test_cache_get_items_paged, teardown_cache_test);
+  g_test_add_vtable (ATK_TEST_PATH_CACHE "/atk_test_cache_get_items_paged_unknown_cursor",
+                     0, NULL, NULL, atk_test_cache_get_items_paged_unknown_cursor, teardown_cache_test);
+  g_test_add_vtable (ATK_TEST_PATH_CACHE "/atk_test_cache_get_items_paged_other_sender",
+                     0, NULL, NULL, atk_test_cache_get_items_paged_other_sender, teardown_cache_test);
+  g_test_add_vtable (ATK_TEST_PATH_CACHE "/atk_test_cache_get_items_paged_restart",
+                     0, NULL, NULL, atk_test_cache_get_items_paged_restart, teardown_cache_test);
+  g_test_add_vtable (ATK_TEST_PATH_CACHE "/atk_test_cache_get_properties",
+                     0, NULL, NULL, atk_test_cache_get_properties, teardown_cache_test);
+}